@@ -3,10 +3,26 @@
 #include <chrono>
 #include <algorithm>
 #include <cmath>
+#include <memory>
+#include <mutex>
 #include <type_traits>
 #include <vector>
+#include <omp.h>
 
 #define USE_CACHE true
+// Store the cache as bricks in Morton order instead of a linear CImg, see BrickedCache
+#define USE_BRICKED_CACHE true
+// Compress the cache of the segmented grids, i.e. subsampled with SubsampleMethod::Skip, see PaletteCache
+#define USE_PALETTE_CACHE true
+// Build coarser levels of the cache, until this size is reached on every axis
+#define USE_PYRAMID true
+#define PYRAMID_MIN_SIZE 16
+// Drop the image from the page cache once it is in the cache, and read it ahead, see ImageReader::setStreamingIngestion()
+#define USE_STREAMING_INGESTION true
+// Find the bricks of the cache that are only background, whose values are then not read, see OccupancyMap
+#define USE_OCCUPANCY_MAP true
+// The values up to this one are background, they are read as 0 when their bricks are skipped
+#define OCCUPANCY_THRESHOLD 0
 
 bool isPtInBB(const glm::vec3& p, const glm::vec3& bbmin, const glm::vec3& bbmax) {
     for(int i = 0; i < 3; ++i) {
@@ -20,12 +36,16 @@ Image::ImageDataType Sampler::getInternalDataType() const {
     return this->image->getInternalDataType();
 }
 
-Grid::Grid(const std::vector<std::string>& filename, int subsample, const glm::vec3& sizeVoxel, const glm::vec3& nbCubeGridTransferMesh): sampler(Sampler(filename, subsample, sizeVoxel)), DrawableGrid(this) {
+int Sampler::getBitDepth() const {
+    return (this->getInternalDataType() & Image::ImageDataType::Bit_8) ? 8 : 16;
+}
+
+Grid::Grid(const std::vector<std::string>& filename, int subsample, const glm::vec3& sizeVoxel, const glm::vec3& nbCubeGridTransferMesh, SubsampleMethod subsampleMethod, const std::pair<glm::vec3, glm::vec3>& roi, std::size_t memoryBudget, bool useIndexFile): sampler(Sampler(filename, subsample, sizeVoxel, subsampleMethod, roi, memoryBudget, useIndexFile)), DrawableGrid(this) {
     this->buildTetmesh(nbCubeGridTransferMesh);
     this->history = new History(this->vertices, this->coordinate_system);
 }
 
-Grid::Grid(const std::vector<std::string>& filename, int subsample, const glm::vec3& sizeVoxel, const std::string& fileNameTransferMesh): sampler(Sampler(filename, subsample, sizeVoxel)), DrawableGrid(this) {
+Grid::Grid(const std::vector<std::string>& filename, int subsample, const glm::vec3& sizeVoxel, const std::string& fileNameTransferMesh, SubsampleMethod subsampleMethod, const std::pair<glm::vec3, glm::vec3>& roi, std::size_t memoryBudget, bool useIndexFile): sampler(Sampler(filename, subsample, sizeVoxel, subsampleMethod, roi, memoryBudget, useIndexFile)), DrawableGrid(this) {
     this->loadMESH(fileNameTransferMesh);
 }
 
@@ -40,7 +60,28 @@ void Grid::buildTetmesh(const glm::vec3& nbCube) {
     std::cout << "***" << std::endl;
     this->buildGrid(nbCube, sizeCube, glm::vec3(0., 0., 0.));
     // Here this initial mesh is built directly using the sampler dimension because we want it to match the sampler
-    this->initialMesh.buildGrid(nbCube, this->sampler.getDimension() / nbCube, glm::vec3(0., 0., 0.));
+    // It starts at the region of interest, as the sampler is queried with coordinates relative to the whole image
+    this->initialMesh.buildGrid(nbCube, this->sampler.getDimension() / nbCube, this->sampler.bbMin);
+}
+
+bool Grid::expandROI(const std::pair<glm::vec3, glm::vec3>& roi) {
+    // The meshes loaded from a file have no grid dimensions to build them again
+    if(this->nbTetra[0] == 0 || this->nbTetra[1] == 0 || this->nbTetra[2] == 0) {
+        std::cout << "WARNING: the region of interest of a grid with a tetrahedral mesh loaded from a file cannot be expanded" << std::endl;
+        return false;
+    }
+    if(!this->sampler.expandROI(roi))
+        return false;
+    // buildGrid() only works on empty meshes
+    const glm::vec3 nbCube = this->nbTetra;
+    this->mesh.clear();
+    this->nbTetra = glm::vec3(0., 0., 0.);
+    this->initialMesh.mesh.clear();
+    this->initialMesh.nbTetra = glm::vec3(0., 0., 0.);
+    this->buildTetmesh(nbCube);
+    delete this->history;
+    this->history = new History(this->vertices, this->coordinate_system);
+    return true;
 }
 
 uint16_t Grid::getValueFromPoint(const glm::vec3& p, Interpolation::Method interpolationMethod) const {
@@ -93,7 +134,7 @@ void Grid::loadMESH(std::string const &filename) {
     this->initialMesh.loadMESH(filename);
     this->texCoord.clear();
     for(int i = 0; i < this->vertices.size(); ++i) {
-        this->texCoord.push_back((this->vertices[i]/this->sampler.resolutionRatio)/this->sampler.getDimension());
+        this->texCoord.push_back((this->vertices[i]/this->sampler.resolutionRatio - this->sampler.bbMin)/this->sampler.getDimension());
     }    
 }
 
@@ -122,6 +163,12 @@ void Grid::sampleSliceGridValues(const glm::vec3& slice, const std::pair<glm::ve
     std::cout << "Scene size: " << sceneSize << std::endl;
     std::cout << "Voxel size: " << voxelSizeConvert << std::endl;
 
+    // Zoomed out views are sampled from a coarser level of the pyramid, whose voxels are not larger than the pixels
+    glm::vec3 gridVoxelSize = this->getVoxelSize();
+    convert(gridVoxelSize);
+    const int level = this->sampler.getLevelForFootprint(std::min(voxelSizeConvert.x / gridVoxelSize.x, voxelSizeConvert.y / gridVoxelSize.y));
+    std::cout << "Pyramid level: " << level << std::endl;
+
     auto isInScene = [&](glm::vec3& p) {
         return (p.x > bbMinScene.x && p.y > bbMinScene.y && p.z > bbMinScene.z && p.x < bbMaxScene.x && p.y < bbMaxScene.y && p.z < bbMaxScene.z);
     };
@@ -141,47 +188,60 @@ void Grid::sampleSliceGridValues(const glm::vec3& slice, const std::pair<glm::ve
     result.clear();
     result.resize(imgSize[0] * imgSize[1], 0);
 
-    #pragma omp parallel for schedule(dynamic)
-    for(int tetIdx = 0; tetIdx < this->mesh.size(); ++tetIdx) {
-        const Tetrahedron& tet = this->mesh[tetIdx];
-        glm::vec3 bbMin = tet.getBBMin();
-        fromWorldToImage(bbMin);
-        bbMin.x = std::ceil(bbMin.x) - 1;
-        bbMin.y = std::ceil(bbMin.y) - 1;
-        bbMin.z = std::ceil(bbMin.z) - 1;
-        glm::vec3 bbMax = tet.getBBMax();
-        fromWorldToImage(bbMax);
-        bbMax.x = std::floor(bbMax.x) + 1;
-        bbMax.y = std::floor(bbMax.y) + 1;
-        bbMax.z = std::floor(bbMax.z) + 1;
-        if(slice.y == -1 && slice.z == -1) {
-            bbMin.z = slice.x;
-            bbMax.z = slice.x+1;
-        }
-        if(slice.x == -1 && slice.y == -1) {
-            bbMin.z = slice.z;
-            bbMax.z = slice.z+1;
-        }
-        if(slice.x == -1 && slice.z == -1) {
-            bbMin.z = slice.y;
-            bbMax.z = slice.y+1;
-        }
-        for(int k = bbMin.z; k < int(bbMax.z); ++k) {
-            for(int j = bbMin.y; j < int(bbMax.y); ++j) {
-                for(int i = bbMin.x; i < int(bbMax.x); ++i) {
-                    int insertIdx = i + j*imgSize[0];
-
-                    glm::vec3 p(i, j, k);
-                    p += glm::vec3(.5, .5, .5);
-                    fromImageToWorld(p);
-
-                    if(isInScene(p) && tet.isInTetrahedron(p)) {
-                        if(this->getCoordInInitial(this->initialMesh, p, p, tetIdx)) {
-                            result[insertIdx] = this->sampler.getValue(p, interpolationMethod);
+    #pragma omp parallel
+    {
+        // The points of each tetrahedron are interpolated in a single batch
+        std::vector<glm::vec3> points;
+        std::vector<int> pointsIdx;
+        std::vector<uint16_t> values;
+        #pragma omp for schedule(dynamic)
+        for(int tetIdx = 0; tetIdx < this->mesh.size(); ++tetIdx) {
+            const Tetrahedron& tet = this->mesh[tetIdx];
+            points.clear();
+            pointsIdx.clear();
+            glm::vec3 bbMin = tet.getBBMin();
+            fromWorldToImage(bbMin);
+            bbMin.x = std::ceil(bbMin.x) - 1;
+            bbMin.y = std::ceil(bbMin.y) - 1;
+            bbMin.z = std::ceil(bbMin.z) - 1;
+            glm::vec3 bbMax = tet.getBBMax();
+            fromWorldToImage(bbMax);
+            bbMax.x = std::floor(bbMax.x) + 1;
+            bbMax.y = std::floor(bbMax.y) + 1;
+            bbMax.z = std::floor(bbMax.z) + 1;
+            if(slice.y == -1 && slice.z == -1) {
+                bbMin.z = slice.x;
+                bbMax.z = slice.x+1;
+            }
+            if(slice.x == -1 && slice.y == -1) {
+                bbMin.z = slice.z;
+                bbMax.z = slice.z+1;
+            }
+            if(slice.x == -1 && slice.z == -1) {
+                bbMin.z = slice.y;
+                bbMax.z = slice.y+1;
+            }
+            for(int k = bbMin.z; k < int(bbMax.z); ++k) {
+                for(int j = bbMin.y; j < int(bbMax.y); ++j) {
+                    for(int i = bbMin.x; i < int(bbMax.x); ++i) {
+                        int insertIdx = i + j*imgSize[0];
+
+                        glm::vec3 p(i, j, k);
+                        p += glm::vec3(.5, .5, .5);
+                        fromImageToWorld(p);
+
+                        if(isInScene(p) && tet.isInTetrahedron(p)) {
+                            if(this->getCoordInInitial(this->initialMesh, p, p, tetIdx)) {
+                                points.push_back(p);
+                                pointsIdx.push_back(insertIdx);
+                            }
                         }
                     }
                 }
             }
+            this->sampler.getValues(points, values, interpolationMethod, level);
+            for(std::size_t i = 0; i < points.size(); ++i)
+                result[pointsIdx[i]] = values[i];
         }
     }
 
@@ -192,7 +252,8 @@ void Grid::sampleSliceGridValues(const glm::vec3& slice, const std::pair<glm::ve
 
 /**************************/
 
-Sampler::Sampler(const std::vector<std::string>& filename, int subsample, const glm::vec3& voxelSize): image(new ImageReader(filename)) {
+Sampler::Sampler(const std::vector<std::string>& filename, int subsample, const glm::vec3& voxelSize, SubsampleMethod subsampleMethod, const std::pair<glm::vec3, glm::vec3>& roi, std::size_t memoryBudget, bool useIndexFile): image(new ImageReader(filename, useIndexFile)), subsampleMethod(subsampleMethod), memoryBudget(memoryBudget), usePagedCache(false), hasStatistics(false) {
+    this->nbChannels = this->image->getNbChannels();
     glm::vec3 samplerResolution = this->image->imgResolution / static_cast<float>(subsample);
     this->resolutionRatio = this->image->imgResolution / samplerResolution;
     // If we naïvely divide the image dimensions for lowered its resolution we have problem is the case of a dimension is 1
@@ -209,12 +270,35 @@ Sampler::Sampler(const std::vector<std::string>& filename, int subsample, const
 
     this->bbMin = glm::vec3(0., 0., 0.);
     this->bbMax = samplerResolution;
+    // Only the region of interest is loaded, so that huge images can be opened at full resolution
+    const std::pair<glm::vec3, glm::vec3> roiBox = this->alignROI(roi);
+    if(roiBox.first[0] < roiBox.second[0] && roiBox.first[1] < roiBox.second[1] && roiBox.first[2] < roiBox.second[2]) {
+        this->bbMin = roiBox.first;
+        this->bbMax = roiBox.second;
+    } else {
+        std::cout << "WARNING: empty region of interest " << roi.first << " " << roi.second << ", the whole image is loaded" << std::endl;
+    }
 
     // Cache management
     this->useCache = USE_CACHE;
     if(this->useCache) {
-        this->cache = new Cache(this->getDimension());
-        this->fillCache();
+        // Images larger than the RAM are read brick by brick when they are sampled
+        this->usePagedCache = this->memoryBudget > 0 && this->getCacheMemory() > this->memoryBudget;
+        if(this->usePagedCache)
+            this->readOccupancy();
+        this->cache = this->createCache();
+        if(this->usePagedCache)
+            std::cout << "The region of interest exceeds the memory budget, it is read on demand" << std::endl;
+        else
+            this->fillCache();
+        if(USE_PYRAMID)
+            this->buildPyramid();
+    }
+    if(!this->hasStatistics && this->image->imageFormat == ImageFormat::BRICKED && this->resolutionRatio == glm::vec3(1., 1., 1.) && this->getDimension() == samplerResolution) {
+        // The statistics of the whole image are stored in the file
+        this->statistics = this->image->brickedImageReader->statistics;
+        this->channelStatistics = {this->statistics};
+        this->hasStatistics = true;
     }
 
     bool useOriginalVoxelSize = true;
@@ -227,6 +311,7 @@ Sampler::Sampler(const std::vector<std::string>& filename, int subsample, const
 
     std::cout << "Sampler initialized..." << std::endl;
     std::cout << "Sampler resolution: " << this->getDimension() << std::endl;
+    std::cout << "Region of interest: " << this->bbMin << " " << this->bbMax << std::endl;
     std::cout << "Resolution ratio: " << this->resolutionRatio << std::endl;
     std::cout << "Voxel size: " << this->voxelSize;
     if(useOriginalVoxelSize)
@@ -244,8 +329,19 @@ glm::vec3 Sampler::getDimension() const {
 }
 
 // This function do not use Grid::getValue as we do not want to open, copy and cast a whole image slice per value
-void Sampler::getGridSlice(int sliceIdx, std::vector<std::uint16_t>& result, int nbChannel) const {
-    if(!this->image) {
+template <typename data_t>
+void Sampler::getGridSlice(int sliceIdx, std::vector<data_t>& result, int nbChannel) const {
+    this->getGridSlice(sliceIdx, result, nbChannel, this->image);
+}
+
+template <typename data_t>
+void Sampler::getGridSlice(int sliceIdx, std::vector<data_t>& result, int nbChannel, const ImageReader * reader) const {
+    this->readGridArea(sliceIdx + static_cast<int>(this->bbMin[2]), this->bbMin, this->bbMax, result, nbChannel, reader);
+}
+
+template <typename data_t>
+void Sampler::readGridArea(int sliceIdx, const glm::vec3& areaMin, const glm::vec3& areaMax, std::vector<data_t>& result, int nbChannel, const ImageReader * reader) const {
+    if(!reader) {
         std::cerr << "[4001] ERROR: Try to [getGridSlice()] on a grid without attached image" << std::endl;
     }
 
@@ -260,7 +356,7 @@ void Sampler::getGridSlice(int sliceIdx, std::vector<std::uint16_t>& result, int
     XYoffsets.first = static_cast<int>(this->resolutionRatio[0]);
     XYoffsets.second = static_cast<int>(this->resolutionRatio[1]);
 
-    std::pair<glm::vec3, glm::vec3> bboxes{this->bbMin, this->bbMax};
+    std::pair<glm::vec3, glm::vec3> bboxes{areaMin, areaMax};
     this->fromSamplerToImage(bboxes.first);
     this->fromSamplerToImage(bboxes.second);
 
@@ -272,30 +368,423 @@ void Sampler::getGridSlice(int sliceIdx, std::vector<std::uint16_t>& result, int
             throw std::runtime_error("Error in getGridSlice: bboxes not aligned with resolution ratio !");
     }
 
-    this->image->getSlice(sliceIdx, result, nbChannel, XYoffsets, bboxes);
+    if(this->subsampleMethod == SubsampleMethod::Mean && Zoffset > 1) {
+        // Average the Zoffset image slices of the grid slice, each of them already averaged on the x and y axis by the reader
+        const int lastSliceIdx = std::min(sliceIdx + Zoffset, static_cast<int>(reader->imgResolution[2]));
+        std::vector<uint64_t> sums;
+        std::vector<data_t> imageSlice;
+        for(int z = sliceIdx; z < lastSliceIdx; ++z) {
+            imageSlice.clear();
+            reader->getSlice(z, imageSlice, nbChannel, XYoffsets, bboxes, this->subsampleMethod);
+            sums.resize(imageSlice.size(), 0);
+            uint64_t * sumsData = sums.data();
+            const data_t * imageSliceData = imageSlice.data();
+            const int nbValues = imageSlice.size();
+            #pragma omp simd
+            for(int i = 0; i < nbValues; ++i)
+                sumsData[i] += imageSliceData[i];
+        }
+        const uint64_t nbImageSlices = lastSliceIdx - sliceIdx;
+        const std::size_t insertIdx = result.size();
+        result.resize(insertIdx + sums.size());
+        for(std::size_t i = 0; i < sums.size(); ++i)
+            result[insertIdx + i] = static_cast<data_t>((sums[i] + nbImageSlices / 2) / nbImageSlices);
+        return;
+    }
+
+    reader->getSlice(sliceIdx, result, nbChannel, XYoffsets, bboxes, this->subsampleMethod);
+}
+
+template void Sampler::getGridSlice<uint8_t>(int sliceIdx, std::vector<uint8_t>& result, int nbChannel) const;
+template void Sampler::getGridSlice<uint16_t>(int sliceIdx, std::vector<uint16_t>& result, int nbChannel) const;
+template void Sampler::getGridSlice<uint8_t>(int sliceIdx, std::vector<uint8_t>& result, int nbChannel, const ImageReader * reader) const;
+template void Sampler::getGridSlice<uint16_t>(int sliceIdx, std::vector<uint16_t>& result, int nbChannel, const ImageReader * reader) const;
+
+std::pair<glm::vec3, glm::vec3> Sampler::alignROI(const std::pair<glm::vec3, glm::vec3>& roi) const {
+    const glm::vec3 samplerResolution = glm::floor(this->image->imgResolution / this->resolutionRatio);
+    std::pair<glm::vec3, glm::vec3> box;
+    for(int i = 0; i < 3; ++i) {
+        // Partially covered sampler voxels are included
+        box.first[i] = std::max(0.f, std::floor(roi.first[i] / this->resolutionRatio[i]));
+        box.second[i] = std::min(std::max(samplerResolution[i], 1.f), std::ceil(std::min(roi.second[i], this->image->imgResolution[i]) / this->resolutionRatio[i]));
+    }
+    return box;
+}
+
+namespace {
+    //! @brief Copies of an ImageReader for the threads that load the bricks of a PagedCache, as a reader cannot be used by several threads at once.
+    class ImageReaderPool {
+    public:
+        ImageReaderPool(const ImageReader * source): source(source) {}
+
+        std::unique_ptr<ImageReader> acquire() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if(!this->readers.empty()) {
+                    std::unique_ptr<ImageReader> reader = std::move(this->readers.back());
+                    this->readers.pop_back();
+                    return reader;
+                }
+            }
+            return std::unique_ptr<ImageReader>(new ImageReader(*this->source));
+        }
+
+        void release(std::unique_ptr<ImageReader> reader) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->readers.push_back(std::move(reader));
+        }
+
+    private:
+        const ImageReader * source;
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ImageReader>> readers;
+    };
+
+    //! @brief Copy a width * height area into a slice of sliceWidth values per row, starting at (x, y).
+    template <typename data_t>
+    void copyArea(const std::vector<data_t>& area, int width, int height, std::vector<data_t>& slice, int sliceWidth, int x, int y) {
+        for(int j = 0; j < height; ++j)
+            std::copy(area.begin() + static_cast<std::size_t>(j) * width, area.begin() + static_cast<std::size_t>(j + 1) * width, slice.begin() + static_cast<std::size_t>(y + j) * sliceWidth + x);
+    }
+}
+
+bool Sampler::expandROI(const std::pair<glm::vec3, glm::vec3>& roi) {
+    const std::pair<glm::vec3, glm::vec3> roiBox = this->alignROI(roi);
+    const glm::vec3 newMin = glm::min(this->bbMin, roiBox.first);
+    const glm::vec3 newMax = glm::max(this->bbMax, roiBox.second);
+    if(newMin == this->bbMin && newMax == this->bbMax)
+        return false;
+
+    std::cout << "Expand the region of interest to: " << newMin << " " << newMax << std::endl;
+    const glm::vec3 residentMin = this->bbMin;
+    const glm::vec3 residentMax = this->bbMax;
+    this->bbMin = newMin;
+    this->bbMax = newMax;
+    if(!this->useCache)
+        return true;
+
+    // The coarser levels of a PagedCache read the previous cache
+    this->clearPyramid();
+    Cache * resident = this->cache;
+    this->usePagedCache = this->memoryBudget > 0 && this->getCacheMemory() > this->memoryBudget;
+    // The previous cache keeps its own copy of the occupancy map
+    if(this->usePagedCache)
+        this->readOccupancy();
+    this->cache = this->createCache();
+    if(this->usePagedCache) {
+        // The statistics of the previous region do not cover the new one
+        this->hasStatistics = false;
+    } else {
+        this->fillCache(resident, residentMin, residentMax);
+    }
+    delete resident;
+    if(USE_PYRAMID)
+        this->buildPyramid();
+    return true;
+}
+
+Cache * Sampler::createCache() const {
+    if(this->usePagedCache) {
+        if(this->getBitDepth() == 8)
+            return this->createPagedCache<uint8_t>();
+        return this->createPagedCache<uint16_t>();
+    }
+    // The labels of a segmented grid come in large regions of the same value
+    if(USE_PALETTE_CACHE && this->subsampleMethod == SubsampleMethod::Skip) {
+        if(this->getBitDepth() == 8)
+            return new PaletteCache<uint8_t>(this->getDimension(), this->nbChannels);
+        return new PaletteCache<uint16_t>(this->getDimension(), this->nbChannels);
+    }
+    if(USE_BRICKED_CACHE) {
+        if(this->getBitDepth() == 8)
+            return new BrickedCache<uint8_t>(this->getDimension(), this->nbChannels);
+        return new BrickedCache<uint16_t>(this->getDimension(), this->nbChannels);
+    }
+    if(this->getBitDepth() == 8)
+        return new CImgCache<uint8_t>(this->getDimension(), this->nbChannels);
+    return new CImgCache<uint16_t>(this->getDimension(), this->nbChannels);
 }
 
-void Sampler::fillCache() {
+template <typename data_t>
+Cache * Sampler::createPagedCache() const {
+    std::shared_ptr<ImageReaderPool> readers = std::make_shared<ImageReaderPool>(this->image);
+    const glm::vec3 bbMin = this->bbMin;
+    const int nbChannels = this->nbChannels;
+    auto loader = [this, readers, bbMin, nbChannels](const glm::ivec3& min, const glm::ivec3& max, std::vector<data_t>& values) {
+        std::unique_ptr<ImageReader> reader = readers->acquire();
+        for(int z = min.z; z < max.z; ++z)
+            this->readGridArea(z + static_cast<int>(bbMin[2]), glm::vec3(min) + bbMin, glm::vec3(max) + bbMin, values, nbChannels, reader.get());
+        readers->release(std::move(reader));
+    };
+    // The background bricks are never read from the image
+    typename PagedCache<data_t>::EmptyTest isEmpty;
+    if(this->occupancy.isValid()) {
+        std::shared_ptr<const OccupancyMap> occupancy = std::make_shared<const OccupancyMap>(this->occupancy);
+        isEmpty = [occupancy](const glm::ivec3& min, const glm::ivec3& max) { return occupancy->isEmpty(min, max - 1); };
+    }
+    // The coarser levels take 1/8 of the capacity of their finer level, so that the whole pyramid stays within the budget
+    return new PagedCache<data_t>(this->getDimension(), this->nbChannels, this->memoryBudget / 8 * 7, loader, isEmpty);
+}
+
+void Sampler::readOccupancy() {
+    this->occupancy = OccupancyMap();
+    // The tiles of a bricked image are the voxels of the sampler only at full resolution
+    if(!USE_OCCUPANCY_MAP || this->image->imageFormat != ImageFormat::BRICKED || this->resolutionRatio != glm::vec3(1., 1., 1.))
+        return;
+    auto start = std::chrono::steady_clock::now();
+    const BrickedReader * reader = this->image->brickedImageReader;
+    const int brickSize = reader->getBrickSize();
+    const glm::ivec3 roiMin(this->bbMin);
+    const glm::ivec3 roiMax = glm::ivec3(this->bbMax) - 1;
+    this->occupancy = OccupancyMap(glm::ivec3(this->getDimension()), OCCUPANCY_THRESHOLD);
+    #pragma omp parallel for schedule(dynamic)
+    for(int z = roiMin.z; z <= roiMax.z; ++z) {
+        for(int brickY = roiMin.y / brickSize; brickY <= roiMax.y / brickSize; ++brickY) {
+            for(int brickX = roiMin.x / brickSize; brickX <= roiMax.x / brickSize; ++brickX) {
+                if(reader->isTileEmpty(z, brickX, brickY))
+                    continue;
+                // Part of the tile in the region of interest
+                const glm::ivec3 tileMin(std::max(brickX * brickSize, roiMin.x), std::max(brickY * brickSize, roiMin.y), z);
+                const glm::ivec3 tileMax(std::min((brickX + 1) * brickSize - 1, roiMax.x), std::min((brickY + 1) * brickSize - 1, roiMax.y), z);
+                this->occupancy.setOccupied(tileMin - roiMin, tileMax - roiMin);
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end-start;
+    std::cout << "Occupancy map read in: " << elapsed_seconds.count() << "s, " << this->occupancy.getOccupancy() * 100. << "% of the bricks are occupied" << std::endl;
+}
+
+std::size_t Sampler::getCacheMemory() const {
+    const glm::vec3 dimension = this->getDimension();
+    return static_cast<std::size_t>(dimension[0]) * static_cast<std::size_t>(dimension[1]) * static_cast<std::size_t>(dimension[2]) * this->nbChannels * (this->getBitDepth() / 8);
+}
+
+void Sampler::fillCache(const Cache * resident, const glm::vec3& residentMin, const glm::vec3& residentMax) {
     if(!this->image) {
         std::cerr << "[4001] ERROR: Try to [fillCache()] on a grid without attached image" << std::endl;
     }
-    std::vector<uint16_t> slice;
     std::cout << "Filling the cache" << std::endl;
-    for(int z = 0; z < this->getDimension()[2]; ++z) {
-        slice.clear();
-        this->getGridSlice(z, slice, 1);
-        this->cache->storeImage(z, slice);
-    }
+    auto start = std::chrono::steady_clock::now();
+
+    const glm::vec3 dimension = this->getDimension();
+    const int nbSlices = dimension[2];
+    const int nbChannels = this->nbChannels;
+    this->channelStatistics.assign(nbChannels, ImageStatistics());
+    this->occupancy = USE_OCCUPANCY_MAP ? OccupancyMap(glm::ivec3(dimension), OCCUPANCY_THRESHOLD) : OccupancyMap();
+    // Each thread reads whole blocks of slices, e.g. the bricks of a bricked image, instead of interleaving with the other threads
+    const int chunkSize = std::max(1, this->image->getSlicesPerBlock() / static_cast<int>(this->resolutionRatio[2]));
+    // The slices are read only once, unless the cache is expanded, but reading ahead whole slices is only worth it if they are loaded entirely
+    const std::pair<glm::vec3, glm::vec3> wholeImage = this->alignROI(Sampler::getWholeImageROI());
+    const bool wholeSlices = this->bbMin[0] == wholeImage.first[0] && this->bbMin[1] == wholeImage.first[1] && this->bbMax[0] == wholeImage.second[0] && this->bbMax[1] == wholeImage.second[1];
+    if(USE_STREAMING_INGESTION && !resident && wholeSlices)
+        this->image->setStreamingIngestion((this->subsampleMethod == SubsampleMethod::Mean) ? 1 : static_cast<int>(this->resolutionRatio[2]));
+    // Slices are read with the bit depth of the cache
+    auto fillSlices = [&](auto typeTag) {
+        using data_t = typename decltype(typeTag)::type;
+        #pragma omp parallel
+        {
+            // A libtiff handle cannot be shared between threads, so each worker reads through its own copy of the reader
+            ImageReader * reader = (omp_get_thread_num() == 0) ? this->image : new ImageReader(*this->image);
+            std::vector<data_t> slice;
+            // The statistics are computed while the slices are in memory instead of scanning the cache afterwards
+            std::vector<ImageStatistics> threadStatistics(nbChannels);
+            std::vector<uint8_t> occupiedTiles;
+            std::vector<data_t> area;
+            // Read the area [areaMin, areaMax[ of the grid slice sliceIdx into slice
+            auto readArea = [&](int sliceIdx, const glm::vec3& areaMin, const glm::vec3& areaMax) {
+                if(areaMin[0] >= areaMax[0] || areaMin[1] >= areaMax[1])
+                    return;
+                area.clear();
+                this->readGridArea(sliceIdx, areaMin, areaMax, area, nbChannels, reader);
+                copyArea(area, (areaMax[0] - areaMin[0]) * nbChannels, areaMax[1] - areaMin[1], slice, dimension[0] * nbChannels, (areaMin[0] - this->bbMin[0]) * nbChannels, areaMin[1] - this->bbMin[1]);
+            };
+            #pragma omp for schedule(dynamic, chunkSize)
+            for(int z = 0; z < nbSlices; ++z) {
+                slice.clear();
+                const int sliceIdx = z + static_cast<int>(this->bbMin[2]);
+                if(resident && sliceIdx >= residentMin[2] && sliceIdx < residentMax[2]) {
+                    // Only the bands around the resident region are read
+                    slice.resize(static_cast<std::size_t>(dimension[0]) * dimension[1] * nbChannels);
+                    area.clear();
+                    resident->getImage(sliceIdx - static_cast<int>(residentMin[2]), area);
+                    copyArea(area, (residentMax[0] - residentMin[0]) * nbChannels, residentMax[1] - residentMin[1], slice, dimension[0] * nbChannels, (residentMin[0] - this->bbMin[0]) * nbChannels, residentMin[1] - this->bbMin[1]);
+                    readArea(sliceIdx, glm::vec3(this->bbMin[0], this->bbMin[1], 0.), glm::vec3(this->bbMax[0], residentMin[1], 0.));
+                    readArea(sliceIdx, glm::vec3(this->bbMin[0], residentMax[1], 0.), glm::vec3(this->bbMax[0], this->bbMax[1], 0.));
+                    readArea(sliceIdx, glm::vec3(this->bbMin[0], residentMin[1], 0.), glm::vec3(residentMin[0], residentMax[1], 0.));
+                    readArea(sliceIdx, glm::vec3(residentMax[0], residentMin[1], 0.), glm::vec3(this->bbMax[0], residentMax[1], 0.));
+                } else {
+                    // All the channels are read in a single pass
+                    this->getGridSlice(z, slice, nbChannels, reader);
+                }
+                // The tiles without any value are not read again by the statistics
+                const std::vector<uint8_t> * emptyTiles = nullptr;
+                if(this->occupancy.isValid()) {
+                    this->occupancy.addSlice(z, slice, nbChannels, occupiedTiles);
+                    if(this->occupancy.threshold == 0)
+                        emptyTiles = &occupiedTiles;
+                }
+                for(int c = 0; c < nbChannels; ++c)
+                    threadStatistics[c].addSlice(z, slice, dimension[0], dimension[1], nbChannels, c, emptyTiles);
+                // Each slice is a distinct region of the cache, no lock is needed
+                this->cache->storeImage(z, slice);
+            }
+            #pragma omp critical
+            {
+                for(int c = 0; c < nbChannels; ++c)
+                    this->channelStatistics[c].merge(threadStatistics[c]);
+            }
+            if(reader != this->image)
+                delete reader;
+        }
+    };
+    if(this->getBitDepth() == 8)
+        fillSlices(Image::tag<uint8_t>());
+    else
+        fillSlices(Image::tag<uint16_t>());
+    this->image->setStreamingIngestion(0);
+    this->statistics = this->channelStatistics[0];
+    this->hasStatistics = true;
+    this->setMinMax(this->statistics.minValue, this->statistics.maxValue);
+
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end-start;
+    std::cout << "Cache filled in: " << elapsed_seconds.count() << "s";
+    if(this->occupancy.isValid())
+        std::cout << ", " << this->occupancy.getOccupancy() * 100. << "% of the bricks are occupied";
+    std::cout << std::endl;
 }
 
 uint16_t Sampler::getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod) const {
     if(this->useCache) {
-        return this->cache->getValue(coord, interpolationMethod);
+        // Testing the neighbourhood of a single voxel costs as much as reading it
+        if(interpolationMethod != Interpolation::Method::NearestNeighbor && this->isBackground(coord, interpolationMethod))
+            return 0;
+        return this->cache->getValue(coord - this->bbMin, interpolationMethod);
     } else {
         return this->image->getValue(coord * this->resolutionRatio);
     }
 }
 
+uint16_t Sampler::getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod, int level) const {
+    if(level <= 0 || level >= this->getNbLevels())
+        return this->getValue(coord, interpolationMethod);
+    if(interpolationMethod != Interpolation::Method::NearestNeighbor && this->isBackground(coord, interpolationMethod, level))
+        return 0;
+    return this->pyramid[level - 1]->getValue((coord - this->bbMin) / static_cast<float>(1 << level), interpolationMethod);
+}
+
+void Sampler::getValues(const std::vector<glm::vec3>& coords, std::vector<uint16_t>& values, Interpolation::Method interpolationMethod, int level) const {
+    values.resize(coords.size());
+    if(!this->useCache) {
+        for(std::size_t i = 0; i < coords.size(); ++i)
+            values[i] = this->getValue(coords[i], interpolationMethod);
+        return;
+    }
+    if(level < 0 || level >= this->getNbLevels())
+        level = 0;
+    Cache * levelCache = (level == 0) ? this->cache : this->pyramid[level - 1];
+    const float levelScale = static_cast<float>(1 << level);
+    if(!this->occupancy.isValid() || interpolationMethod == Interpolation::Method::NearestNeighbor) {
+        std::vector<glm::vec3> levelCoords(coords.size());
+        for(std::size_t i = 0; i < coords.size(); ++i)
+            levelCoords[i] = (coords[i] - this->bbMin) / levelScale;
+        levelCache->getValues(levelCoords.data(), levelCoords.size(), interpolationMethod, values.data());
+        return;
+    }
+    // Only the points outside of the background are interpolated
+    std::vector<glm::vec3> levelCoords;
+    std::vector<std::size_t> pointsIdx;
+    levelCoords.reserve(coords.size());
+    pointsIdx.reserve(coords.size());
+    for(std::size_t i = 0; i < coords.size(); ++i) {
+        if(this->isBackground(coords[i], interpolationMethod, level)) {
+            values[i] = 0;
+        } else {
+            levelCoords.push_back((coords[i] - this->bbMin) / levelScale);
+            pointsIdx.push_back(i);
+        }
+    }
+    std::vector<uint16_t> pointsValues(levelCoords.size());
+    levelCache->getValues(levelCoords.data(), levelCoords.size(), interpolationMethod, pointsValues.data());
+    for(std::size_t i = 0; i < pointsIdx.size(); ++i)
+        values[pointsIdx[i]] = pointsValues[i];
+}
+
+bool Sampler::isBackground(const glm::vec3& coord, Interpolation::Method interpolationMethod, int level) const {
+    if(!this->occupancy.isValid())
+        return false;
+    if(level < 0 || level >= this->getNbLevels())
+        level = 0;
+    // Voxels read by the interpolation, see Interpolation::interpolate()
+    const glm::ivec3 voxel(glm::floor((coord - this->bbMin) / static_cast<float>(1 << level)));
+    int before = 0;
+    int after = 0;
+    if(interpolationMethod == Interpolation::Method::Linear) {
+        after = 1;
+    } else if(interpolationMethod == Interpolation::Method::Cubic) {
+        before = 1;
+        after = 2;
+    }
+    return this->isBackgroundArea(level, voxel - before, voxel + after);
+}
+
+bool Sampler::isBackgroundArea(int level, const glm::ivec3& min, const glm::ivec3& max) const {
+    if(!this->occupancy.isValid())
+        return false;
+    // A voxel of a level covers 2^level voxels of the cache on each axis
+    const int scale = 1 << level;
+    return this->occupancy.isEmpty(min * scale, (max + 1) * scale - 1);
+}
+
+void Sampler::buildPyramid() {
+    auto start = std::chrono::steady_clock::now();
+    // Labels of segmented images cannot be averaged
+    const bool average = this->subsampleMethod == SubsampleMethod::Mean;
+    const Cache * level = this->cache;
+    glm::vec3 size = level->getSize();
+    while(size[0] > PYRAMID_MIN_SIZE || size[1] > PYRAMID_MIN_SIZE || size[2] > PYRAMID_MIN_SIZE) {
+        this->pyramid.push_back(level->buildCoarserLevel(average));
+        level = this->pyramid.back();
+        size = level->getSize();
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end-start;
+    std::cout << "Pyramid of " << this->pyramid.size() << " levels built in: " << elapsed_seconds.count() << "s" << std::endl;
+}
+
+void Sampler::clearPyramid() {
+    for(Cache * level : this->pyramid)
+        delete level;
+    this->pyramid.clear();
+}
+
+int Sampler::getNbLevels() const {
+    return this->useCache ? this->pyramid.size() + 1 : 1;
+}
+
+glm::vec3 Sampler::getLevelDimension(int level) const {
+    if(level == 0)
+        return this->getDimension();
+    return this->pyramid[level - 1]->getSize();
+}
+
+int Sampler::getLevelForFootprint(float footprint) const {
+    int level = 0;
+    while(level + 1 < this->getNbLevels() && static_cast<float>(1 << (level + 1)) <= footprint)
+        ++level;
+    return level;
+}
+
+int Sampler::getLevelForResolution(const glm::vec3& maxResolution) const {
+    for(int level = 0; level < this->getNbLevels(); ++level) {
+        const glm::vec3 dimension = this->getLevelDimension(level);
+        if(dimension[0] <= maxResolution[0] && dimension[1] <= maxResolution[1] && dimension[2] <= maxResolution[2])
+            return level;
+    }
+    return this->getNbLevels() - 1;
+}
+
 void Sampler::fromSamplerToImage(glm::vec3& p) const {
     p = p * this->resolutionRatio;
 }
@@ -304,17 +793,46 @@ void Sampler::fromImageToSampler(glm::vec3& p) const {
     p = p / this->resolutionRatio;
 }
 
+bool Sampler::getMinMax(uint16_t& minValue, uint16_t& maxValue) const {
+    if(this->hasStatistics) {
+        minValue = this->statistics.minValue;
+        maxValue = this->statistics.maxValue;
+        return true;
+    }
+    // The index only stores the min/max values of the whole image, for the grids whose voxels are taken as is from the image
+    if(this->subsampleMethod == SubsampleMethod::Mean && this->resolutionRatio != glm::vec3(1., 1., 1.))
+        return false;
+    if(!this->isWholeImage())
+        return false;
+    return this->image->index.getMinMax(this->resolutionRatio, minValue, maxValue);
+}
+
+void Sampler::setMinMax(uint16_t minValue, uint16_t maxValue, bool exact) {
+    this->image->minValue = minValue;
+    this->image->maxValue = maxValue;
+    if(!exact)
+        return;
+    if(this->subsampleMethod == SubsampleMethod::Mean && this->resolutionRatio != glm::vec3(1., 1., 1.))
+        return;
+    // The values of a region of interest would be taken for the ones of the whole image at the next opening
+    if(!this->isWholeImage())
+        return;
+    this->image->index.setMinMax(this->resolutionRatio, minValue, maxValue);
+}
+
+bool Sampler::isWholeImage() const {
+    const std::pair<glm::vec3, glm::vec3> wholeImage = this->alignROI(Sampler::getWholeImageROI());
+    return this->bbMin == wholeImage.first && this->bbMax == wholeImage.second;
+}
+
 std::vector<int> Sampler::getHistogram() const {
-   if(useCache)  {
-       uint16_t minValue = this->image->minValue;
-       uint16_t maxValue = this->image->maxValue;
-       const CImg img = this->cache->img.get_histogram((maxValue - minValue)+1, minValue, maxValue);
-       std::vector<int> result;
-       for(int i = 0; i < minValue; ++i) {
-           result.push_back(0);
-       }
-       for(auto value : img) {
-           result.push_back(value);
+   if(this->hasStatistics)  {
+       // Only the values in [minValue, maxValue] are counted, the background is ignored
+       uint16_t minValue = this->statistics.minValue;
+       uint16_t maxValue = this->statistics.maxValue;
+       std::vector<int> result(maxValue + 1, 0);
+       for(int value = minValue; value <= maxValue; ++value) {
+           result[value] = static_cast<int>(std::min<uint64_t>(this->statistics.histogram[value], std::numeric_limits<int>::max()));
        }
        return result;
    } else {
@@ -4,6 +4,7 @@
 #include "../drawable/drawable_grid.hpp"
 #include "tetrahedral_mesh.hpp"
 #include "../images/image.hpp"
+#include "../images/statistics.hpp"
 
 //! \addtogroup geometry
 //! @{
@@ -17,16 +18,62 @@ private:
 public:
     glm::vec3 resolutionRatio;
 
+    //! @brief Region of interest of the image loaded in the cache, in sampler space, bbMax excluded.
+    //! The cache and the pyramid only store this region, the coordinates given to getValue() are still relative to the whole image.
     glm::vec3 bbMin;
     glm::vec3 bbMax;
 
     bool useCache;
+    //! @brief Size in bytes above which the region of interest is not loaded, but read on demand by a PagedCache. 0 for no limit.
+    std::size_t memoryBudget;
+    //! @brief True if the cache is a PagedCache, it then has no statistics unless they are stored in the image.
+    bool usePagedCache;
     Cache * cache;
     ImageReader * image;
 
-    Sampler(const std::vector<std::string>& filename, int subsample, const glm::vec3& voxelSize);
+    //! @brief Coarser versions of the cache, built when the cache is filled: pyramid[i] has the resolution of the cache divided by 2^(i+1).
+    //! The level 0 is the cache itself. The value of a level l at coordinate c is the one of the grid around coordinate c * 2^l.
+    std::vector<Cache*> pyramid;
+
+    //! @brief How the image voxels are reduced when the grid is subsampled.
+    SubsampleMethod subsampleMethod;
+
+    //! @brief Number of channels of the image, all of them are stored in the cache.
+    int nbChannels;
+
+    //! @brief Statistics of the grid values, computed while the cache is filled.
+    //! Only valid if hasStatistics is true, which is not the case if the cache isn't used.
+    //! statistics are the ones of the first channel, which is the channel returned by getValue().
+    ImageStatistics statistics;
+    std::vector<ImageStatistics> channelStatistics;
+    bool hasStatistics;
+
+    //! @brief Bricks of the region of interest that are only background, on all the channels, in cache coordinates.
+    //! Built while the cache is filled, or from the tiles of a bricked image read by a PagedCache. Not valid if unknown.
+    OccupancyMap occupancy;
+
+    //! @param roi Region of interest to load, in image voxels, see getWholeImageROI(). It is extended to the voxels of the sampler.
+    //! @param memoryBudget See Sampler::memoryBudget.
+    //! @param useIndexFile See ImageReader::ImageReader().
+    Sampler(const std::vector<std::string>& filename, int subsample, const glm::vec3& voxelSize, SubsampleMethod subsampleMethod = SubsampleMethod::Mean, const std::pair<glm::vec3, glm::vec3>& roi = Sampler::getWholeImageROI(), std::size_t memoryBudget = 0, bool useIndexFile = false);
+
+    //! @brief ROI covering any image, as it is clamped to the image.
+    static std::pair<glm::vec3, glm::vec3> getWholeImageROI() {
+        return {glm::vec3(0., 0., 0.), glm::vec3(std::numeric_limits<float>::max())};
+    }
+
+    //! @brief Grow the region of interest to include roi, given in image voxels.
+    //! Only the voxels that are not already in the cache are read from the image, the other ones are copied from the current cache.
+    //! @return false if the region of interest already includes roi.
+    bool expandROI(const std::pair<glm::vec3, glm::vec3>& roi);
 
     uint16_t getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod = Interpolation::Method::NearestNeighbor) const;
+    //! @brief Same as getValue() but read from a level of the pyramid. coord is still given in grid space.
+    uint16_t getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod, int level) const;
+    //! @brief Same as getValue() for a batch of points, which are interpolated at once by the cache, see Cache::getValues().
+    void getValues(const std::vector<glm::vec3>& coords, std::vector<uint16_t>& values, Interpolation::Method interpolationMethod, int level = 0) const;
+    //! @brief True if all the voxels read by getValue() at coord are background, see occupancy. Its value is then 0.
+    bool isBackground(const glm::vec3& coord, Interpolation::Method interpolationMethod = Interpolation::Method::NearestNeighbor, int level = 0) const;
     template<typename DataType>
     DataType getValue(const glm::vec3& coord) const {
         return this->image->getValue<DataType>(coord * this->resolutionRatio);
@@ -37,12 +84,71 @@ public:
     void fromSamplerToImage(glm::vec3& p) const;
     void fromImageToSampler(glm::vec3& p) const;
 
-    void getGridSlice(int sliceIdx, std::vector<std::uint16_t>& result, int nbChannel) const;
+    //! @brief Append the slice sliceIdx of the region of interest to result, sliceIdx is relative to bbMin.
+    //! @note Instantiated for uint8_t and uint16_t results, see getBitDepth().
+    template <typename data_t>
+    void getGridSlice(int sliceIdx, std::vector<data_t>& result, int nbChannel) const;
+    //! @brief Same as getGridSlice() but read through the given reader, which allows each thread to use its own file handles.
+    template <typename data_t>
+    void getGridSlice(int sliceIdx, std::vector<data_t>& result, int nbChannel, const ImageReader * reader) const;
     glm::vec3 getVoxelSize() const;
     Image::ImageDataType getInternalDataType() const;
+    //! @brief Number of bits used to store the values in the cache and in the GPU texture.
+    //! 8 bits images keep their bit depth, all the other ones are stored on 16 bits.
+    int getBitDepth() const;
     std::vector<int> getHistogram() const;
+
+    //! @brief Number of levels of the pyramid, including the cache. 1 if the cache isn't used.
+    int getNbLevels() const;
+    glm::vec3 getLevelDimension(int level) const;
+    //! @brief Coarsest level whose voxels are not larger than footprint voxels of the grid, e.g. the size of the pixels of a zoomed out view.
+    int getLevelForFootprint(float footprint) const;
+    //! @brief Finest level whose resolution do not exceed maxResolution on any axis.
+    int getLevelForResolution(const glm::vec3& maxResolution) const;
+    //! @brief Append a slice of a level of the pyramid to result, with the nbChannels channels of each voxel. Only valid if the cache is used.
+    //! The slices that are only background are not read.
+    template <typename data_t>
+    void getLevelSlice(int level, int sliceIdx, std::vector<data_t>& result) const {
+        const Cache * levelCache = (level == 0) ? this->cache : this->pyramid[level - 1];
+        const glm::ivec3 size(levelCache->getSize());
+        if(this->isBackgroundArea(level, glm::ivec3(0, 0, sliceIdx), glm::ivec3(size.x - 1, size.y - 1, sliceIdx))) {
+            result.resize(result.size() + static_cast<std::size_t>(size.x) * size.y * this->nbChannels, 0);
+            return;
+        }
+        levelCache->getImage(sliceIdx, result);
+    }
+
+    //! @brief Get the min/max values of the grid if they are already known, from the statistics, the image index file or a previous computation.
+    bool getMinMax(uint16_t& minValue, uint16_t& maxValue) const;
+    //! @brief Store the min/max values of the grid in the image and its index file.
+    //! The index file only keeps the min/max values of the whole image, not the ones of a region of interest.
+    //! @param exact False if the values are only estimated, e.g. from a coarser level of the pyramid, they are then not stored in the index file.
+    void setMinMax(uint16_t minValue, uint16_t maxValue, bool exact = true);
 private:
-    void fillCache();
+    //! @brief Convert a ROI in image voxels into a box of sampler voxels, clamped to the image.
+    std::pair<glm::vec3, glm::vec3> alignROI(const std::pair<glm::vec3, glm::vec3>& roi) const;
+    //! @brief True if the region of interest covers the whole image.
+    bool isWholeImage() const;
+    //! @brief Allocate an empty cache of the size of the region of interest, with the bit depth of the sampler.
+    //! If usePagedCache is true, the cache reads the image itself and must not be filled.
+    Cache * createCache() const;
+    template <typename data_t>
+    Cache * createPagedCache() const;
+    //! @brief Size in bytes of the region of interest in a cache.
+    std::size_t getCacheMemory() const;
+    //! @brief Append the area [areaMin, areaMax[ of the grid slice sliceIdx to result, all in sampler space. The z coordinates of the area are ignored.
+    template <typename data_t>
+    void readGridArea(int sliceIdx, const glm::vec3& areaMin, const glm::vec3& areaMax, std::vector<data_t>& result, int nbChannel, const ImageReader * reader) const;
+    //! @brief True if the area [min, max], max included, of a level of the pyramid is only background, see occupancy.
+    bool isBackgroundArea(int level, const glm::ivec3& min, const glm::ivec3& max) const;
+    //! @brief Build the occupancy map of a region of interest read by a PagedCache from the tiles of a bricked image, without reading its voxels.
+    //! It is not valid for the other images.
+    void readOccupancy();
+    //! @brief Read the region of interest into the cache.
+    //! @param resident Previous cache, storing the region [residentMin, residentMax[, whose voxels are copied instead of being read again.
+    void fillCache(const Cache * resident = nullptr, const glm::vec3& residentMin = glm::vec3(0., 0., 0.), const glm::vec3& residentMax = glm::vec3(0., 0., 0.));
+    void buildPyramid();
+    void clearPyramid();
 };
 
 //! @brief A 3D image deformed by a TetMesh and displayed by a DrawableGrid.
@@ -51,11 +157,16 @@ struct Grid : public TetMesh, public DrawableGrid {
     TetMesh initialMesh;
     Sampler sampler;
 
-    Grid(const std::vector<std::string>& filename, int subsample, const glm::vec3& sizeVoxel, const glm::vec3& nbCubeGridTransferMesh);
-    Grid(const std::vector<std::string>& filename, int subsample, const glm::vec3& sizeVoxel, const std::string& fileNameTransferMesh);
+    Grid(const std::vector<std::string>& filename, int subsample, const glm::vec3& sizeVoxel, const glm::vec3& nbCubeGridTransferMesh, SubsampleMethod subsampleMethod = SubsampleMethod::Mean, const std::pair<glm::vec3, glm::vec3>& roi = Sampler::getWholeImageROI(), std::size_t memoryBudget = 0, bool useIndexFile = false);
+    Grid(const std::vector<std::string>& filename, int subsample, const glm::vec3& sizeVoxel, const std::string& fileNameTransferMesh, SubsampleMethod subsampleMethod = SubsampleMethod::Mean, const std::pair<glm::vec3, glm::vec3>& roi = Sampler::getWholeImageROI(), std::size_t memoryBudget = 0, bool useIndexFile = false);
 
     void buildTetmesh(const glm::vec3& nbCube);
 
+    //! @brief Grow the region of interest of the sampler, see Sampler::expandROI().
+    //! The tetrahedral mesh is built again on the new region, so the deformations are lost.
+    //! @return false if nothing changed, which is always the case for the meshes loaded from a file.
+    bool expandROI(const std::pair<glm::vec3, glm::vec3>& roi);
+
     void loadMESH(std::string const &filename) override;
 
     glm::vec3 getVoxelSize() const;
@@ -104,7 +215,8 @@ struct Grid : public TetMesh, public DrawableGrid {
         return this->sampler.getDimension()[2];
     }
     
-    void getGridSlice(int sliceIdx, std::vector<std::uint16_t>& result, int nbChannel) const {
+    template <typename data_t>
+    void getGridSlice(int sliceIdx, std::vector<data_t>& result, int nbChannel) const {
         this->sampler.getGridSlice(sliceIdx, result, nbChannel);
     }
 
@@ -0,0 +1,230 @@
+#include "bricked_image.hpp"
+#include "image.hpp"
+#include <glm/gtx/io.hpp>
+#include <omp.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+namespace {
+    const char brickedImageMagic[4] = {'B', 'V', 'O', 'L'};
+    const uint32_t brickedImageVersion = 1;
+
+    template <typename T>
+    void writeField(std::ostream& stream, T value) {
+        stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    //! @brief Read a field at position and move position after it.
+    template <typename T>
+    bool readField(const uint8_t * data, std::size_t size, std::size_t& position, T& value) {
+        if(position + sizeof(T) > size)
+            return false;
+        std::memcpy(&value, data + position, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+}
+
+bool BrickedImageHeader::readPrefix(const uint8_t * data, std::size_t size) {
+    if(size < BrickedImageHeader::prefixSize || std::memcmp(data, brickedImageMagic, 4) != 0)
+        return false;
+    std::size_t position = 4;
+    uint32_t version = 0;
+    readField(data, size, position, version);
+    if(version != brickedImageVersion)
+        return false;
+    for(int i = 0; i < 3; ++i) {
+        uint32_t resolution = 0;
+        readField(data, size, position, resolution);
+        this->imgResolution[i] = resolution;
+    }
+    for(int i = 0; i < 3; ++i)
+        readField(data, size, position, this->voxelSize[i]);
+    uint32_t bitDepth = 0;
+    uint32_t brickSize = 0;
+    readField(data, size, position, bitDepth);
+    readField(data, size, position, brickSize);
+    readField(data, size, position, this->metadataOffset);
+    this->bitDepth = bitDepth;
+    this->brickSize = brickSize;
+    return (bitDepth == 8 || bitDepth == 16) && brickSize > 0 && this->metadataOffset <= size;
+}
+
+void BrickedImageHeader::writePrefix(std::ostream& stream) const {
+    stream.write(brickedImageMagic, 4);
+    writeField<uint32_t>(stream, brickedImageVersion);
+    for(int i = 0; i < 3; ++i)
+        writeField<uint32_t>(stream, this->imgResolution[i]);
+    for(int i = 0; i < 3; ++i)
+        writeField<float>(stream, this->voxelSize[i]);
+    writeField<uint32_t>(stream, this->bitDepth);
+    writeField<uint32_t>(stream, this->brickSize);
+    writeField<uint64_t>(stream, this->metadataOffset);
+}
+
+bool BrickedImageHeader::readMetadata(const uint8_t * data, std::size_t size, ImageStatistics& statistics, std::vector<BrickTile>& tiles) const {
+    std::size_t position = this->metadataOffset;
+    bool valid = readField(data, size, position, statistics.minValue) && readField(data, size, position, statistics.maxValue);
+    for(int i = 0; i < 3; ++i)
+        valid = valid && readField(data, size, position, statistics.bbMin[i]);
+    for(int i = 0; i < 3; ++i)
+        valid = valid && readField(data, size, position, statistics.bbMax[i]);
+    uint32_t histogramSize = 0;
+    valid = valid && readField(data, size, position, histogramSize);
+    if(!valid || position + histogramSize * sizeof(uint64_t) > size)
+        return false;
+    statistics.histogram.resize(histogramSize);
+    std::memcpy(statistics.histogram.data(), data + position, histogramSize * sizeof(uint64_t));
+    position += histogramSize * sizeof(uint64_t);
+
+    uint64_t nbTiles = 0;
+    if(!readField(data, size, position, nbTiles) || nbTiles != this->getNbTiles())
+        return false;
+    tiles.resize(nbTiles);
+    for(BrickTile& tile : tiles) {
+        uint32_t codec = 0;
+        if(!readField(data, size, position, tile.offset) || !readField(data, size, position, tile.size) || !readField(data, size, position, codec))
+            return false;
+        // Written so that corrupted values cannot overflow
+        if(tile.size > this->metadataOffset || tile.offset > this->metadataOffset - tile.size)
+            return false;
+        tile.codec = static_cast<TileCodec>(codec);
+    }
+    return true;
+}
+
+void BrickedImageHeader::writeMetadata(std::ostream& stream, const ImageStatistics& statistics, const std::vector<BrickTile>& tiles) const {
+    writeField<uint16_t>(stream, statistics.minValue);
+    writeField<uint16_t>(stream, statistics.maxValue);
+    for(int i = 0; i < 3; ++i)
+        writeField<float>(stream, statistics.bbMin[i]);
+    for(int i = 0; i < 3; ++i)
+        writeField<float>(stream, statistics.bbMax[i]);
+    writeField<uint32_t>(stream, statistics.histogram.size());
+    stream.write(reinterpret_cast<const char*>(statistics.histogram.data()), statistics.histogram.size() * sizeof(uint64_t));
+
+    writeField<uint64_t>(stream, tiles.size());
+    for(const BrickTile& tile : tiles) {
+        writeField<uint64_t>(stream, tile.offset);
+        writeField<uint32_t>(stream, tile.size);
+        writeField<uint32_t>(stream, static_cast<uint32_t>(tile.codec));
+    }
+}
+
+/***/
+
+bool writeBrickedImage(const ImageReader& source, const std::string& filename, bool compress) {
+    // Other images would not be read back with their original values
+    const Image::ImageDataType dataType = source.getInternalDataType();
+    const bool isUnsigned8Or16Bits = dataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_8) || dataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_16);
+    if(!isUnsigned8Or16Bits || source.getNbChannels() > 1) {
+        std::cout << "ERROR: only single channel images of unsigned 8 or 16 bits values can be written as bricked images, [" << filename << "] is not written" << std::endl;
+        return false;
+    }
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) {
+        std::cout << "WARNING: cannot write the bricked image [" << filename << "]" << std::endl;
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    BrickedImageHeader header;
+    header.imgResolution = source.imgResolution;
+    header.voxelSize = source.voxelSize;
+    header.bitDepth = (dataType & Image::ImageDataType::Bit_8) ? 8 : 16;
+    header.brickSize = BRICK_SIZE;
+    // The metadata offset is only known at the end, the prefix is written again then
+    header.writePrefix(file);
+
+    const glm::ivec3 resolution(header.imgResolution);
+    const glm::ivec3 nbBricks = header.getNbBricks();
+    const int brickSize = header.brickSize;
+    const std::size_t nbBricksPerLayer = static_cast<std::size_t>(nbBricks.x) * nbBricks.y;
+    std::vector<BrickTile> tiles(header.getNbTiles(), BrickTile{0, 0, TileCodec::Raw});
+    ImageStatistics statistics;
+
+    auto writeLayers = [&](auto typeTag) {
+        using data_t = typename decltype(typeTag)::type;
+        // Encoded tiles of the current layer of bricks, indexed by slice then by brick
+        std::vector<std::vector<uint8_t>> layer;
+        std::vector<TileCodec> codecs;
+        for(int brickZ = 0; brickZ < nbBricks.z; ++brickZ) {
+            const int firstSlice = brickZ * brickSize;
+            const int nbSlices = std::min(brickSize, resolution.z - firstSlice);
+            layer.resize(nbSlices * nbBricksPerLayer);
+            codecs.resize(nbSlices * nbBricksPerLayer);
+
+            #pragma omp parallel
+            {
+                // A libtiff handle cannot be shared between threads, so each worker reads through its own copy of the reader
+                const ImageReader * reader = (omp_get_thread_num() == 0) ? &source : new ImageReader(source);
+                std::vector<data_t> slice;
+                std::vector<data_t> tile;
+                ImageStatistics threadStatistics;
+                #pragma omp for schedule(dynamic)
+                for(int s = 0; s < nbSlices; ++s) {
+                    slice.clear();
+                    reader->getSlice(firstSlice + s, slice, 1, {1, 1}, {glm::vec3(0., 0., 0.), header.imgResolution});
+                    threadStatistics.addSlice(firstSlice + s, slice, resolution.x, resolution.y);
+                    for(int brickY = 0; brickY < nbBricks.y; ++brickY) {
+                        for(int brickX = 0; brickX < nbBricks.x; ++brickX) {
+                            const int tileWidth = std::min(brickSize, resolution.x - brickX * brickSize);
+                            const int tileHeight = std::min(brickSize, resolution.y - brickY * brickSize);
+                            tile.resize(static_cast<std::size_t>(tileWidth) * tileHeight);
+                            for(int y = 0; y < tileHeight; ++y) {
+                                const data_t * row = slice.data() + static_cast<std::size_t>(brickY * brickSize + y) * resolution.x + brickX * brickSize;
+                                std::copy(row, row + tileWidth, tile.data() + static_cast<std::size_t>(y) * tileWidth);
+                            }
+                            const std::size_t idx = s * nbBricksPerLayer + brickY * nbBricks.x + brickX;
+                            if(compress) {
+                                codecs[idx] = encodeTile(tile.data(), tile.size(), layer[idx]);
+                            } else {
+                                layer[idx].assign(reinterpret_cast<const uint8_t*>(tile.data()), reinterpret_cast<const uint8_t*>(tile.data() + tile.size()));
+                                codecs[idx] = TileCodec::Raw;
+                            }
+                        }
+                    }
+                }
+                #pragma omp critical
+                statistics.merge(threadStatistics);
+                if(reader != &source)
+                    delete reader;
+            }
+
+            // The tiles of each brick are written next to each other
+            for(int brickY = 0; brickY < nbBricks.y; ++brickY) {
+                for(int brickX = 0; brickX < nbBricks.x; ++brickX) {
+                    for(int s = 0; s < nbSlices; ++s) {
+                        const std::size_t idx = s * nbBricksPerLayer + brickY * nbBricks.x + brickX;
+                        BrickTile& brickTile = tiles[header.getTileIdx(firstSlice + s, brickX, brickY)];
+                        brickTile.offset = static_cast<uint64_t>(file.tellp());
+                        brickTile.size = layer[idx].size();
+                        brickTile.codec = codecs[idx];
+                        file.write(reinterpret_cast<const char*>(layer[idx].data()), layer[idx].size());
+                    }
+                }
+            }
+        }
+    };
+    if(header.bitDepth == 8)
+        writeLayers(Image::tag<uint8_t>());
+    else
+        writeLayers(Image::tag<uint16_t>());
+
+    header.metadataOffset = static_cast<uint64_t>(file.tellp());
+    header.writeMetadata(file, statistics, tiles);
+    file.seekp(0);
+    header.writePrefix(file);
+    file.close();
+    if(!file) {
+        std::cout << "WARNING: error while writing the bricked image [" << filename << "]" << std::endl;
+        return false;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end-start;
+    std::cout << "Bricked image written in: " << elapsed_seconds.count() << "s, " << header.metadataOffset << " bytes of data" << std::endl;
+    return true;
+}
@@ -0,0 +1,170 @@
+#ifndef BRICKED_IMAGE_HPP_
+#define BRICKED_IMAGE_HPP_
+
+#include "statistics.hpp"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Size of the edge of the cubic bricks of the images written by writeBrickedImage()
+#define BRICK_SIZE 64
+
+struct ImageReader;
+
+//! \addtogroup img
+//! @{
+
+//! @brief Codec of a tile of a bricked image.
+enum class TileCodec : uint32_t {
+    Raw = 0,// Values stored as is
+    DeltaRLE = 1// See encodeTile()
+};
+
+//! @brief Position of a tile in a bricked image file.
+struct BrickTile {
+    uint64_t offset;
+    //! @brief Size in the file, 0 for the tiles after the last slice of the image.
+    uint32_t size;
+    TileCodec codec;
+};
+
+//! @brief Layout of the bricked image files (".bvol"), the native format of the software.
+//!
+//! The image is cut in cubic bricks of brickSize voxels, cut by the borders of the image. Each brick is stored as brickSize
+//! consecutive tiles, one per slice, and each tile is compressed on its own so that a slice can be read without decoding whole bricks.
+//! A file contains:
+//! - the fixed size prefix described by this class,
+//! - the tiles, brick after brick (x first, then y, then z),
+//! - the ImageStatistics of the image and the table of the tiles, starting at metadataOffset.
+//!
+//! Values are stored as uint8_t or uint16_t, in the byte order of the machine that wrote the file: only single channel images
+//! of unsigned 8 or 16 bits values can be stored without loss.
+struct BrickedImageHeader {
+    glm::vec3 imgResolution;
+    glm::vec3 voxelSize;
+    int bitDepth;
+    int brickSize;
+    uint64_t metadataOffset;
+
+    static const int prefixSize = 48;
+
+    BrickedImageHeader(): imgResolution(0., 0., 0.), voxelSize(1., 1., 1.), bitDepth(16), brickSize(BRICK_SIZE), metadataOffset(0) {}
+
+    glm::ivec3 getNbBricks() const {
+        return (glm::ivec3(this->imgResolution) + this->brickSize - 1) / this->brickSize;
+    }
+
+    std::size_t getNbTiles() const {
+        const glm::ivec3 nbBricks = this->getNbBricks();
+        return static_cast<std::size_t>(nbBricks.x) * nbBricks.y * nbBricks.z * this->brickSize;
+    }
+
+    //! @brief Index in the table of the tile of the slice sliceIdx in the brick column (brickX, brickY).
+    std::size_t getTileIdx(int sliceIdx, int brickX, int brickY) const {
+        const glm::ivec3 nbBricks = this->getNbBricks();
+        const std::size_t brickIdx = (static_cast<std::size_t>(sliceIdx / this->brickSize) * nbBricks.y + brickY) * nbBricks.x + brickX;
+        return brickIdx * this->brickSize + sliceIdx % this->brickSize;
+    }
+
+    //! @return false if data do not start with a valid prefix.
+    bool readPrefix(const uint8_t * data, std::size_t size);
+    void writePrefix(std::ostream& stream) const;
+
+    bool readMetadata(const uint8_t * data, std::size_t size, ImageStatistics& statistics, std::vector<BrickTile>& tiles) const;
+    void writeMetadata(std::ostream& stream, const ImageStatistics& statistics, const std::vector<BrickTile>& tiles) const;
+};
+
+//! @brief Lightweight lossless codec of a tile: each value is stored as its difference with the previous one, as a zigzag varint,
+//! and runs of identical values are stored as their length. The lowest bit of each varint tells if it is a difference or a run.
+//! This is fast enough to be decoded at disk bandwidth, and shrinks well the background and the segmented images.
+//! @return The codec used, values are stored Raw if they cannot be compressed.
+template <typename data_t>
+TileCodec encodeTile(const data_t * values, std::size_t nbValues, std::vector<uint8_t>& encoded) {
+    encoded.clear();
+    auto writeVarint = [&](uint32_t value) {
+        while(value >= 0x80) {
+            encoded.push_back(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        encoded.push_back(static_cast<uint8_t>(value));
+    };
+
+    const std::size_t rawSize = nbValues * sizeof(data_t);
+    int32_t previous = 0;
+    std::size_t i = 0;
+    while(i < nbValues && encoded.size() < rawSize) {
+        const int32_t delta = static_cast<int32_t>(values[i]) - previous;
+        if(delta == 0) {
+            std::size_t runEnd = i + 1;
+            while(runEnd < nbValues && values[runEnd] == values[i])
+                ++runEnd;
+            writeVarint(static_cast<uint32_t>(runEnd - i - 1) << 1 | 1);
+            i = runEnd;
+        } else {
+            const uint32_t zigzag = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+            writeVarint(zigzag << 1);
+            previous = values[i];
+            ++i;
+        }
+    }
+
+    if(encoded.size() >= rawSize) {
+        encoded.assign(reinterpret_cast<const uint8_t*>(values), reinterpret_cast<const uint8_t*>(values) + rawSize);
+        return TileCodec::Raw;
+    }
+    return TileCodec::DeltaRLE;
+}
+
+//! @brief Decode a tile written by encodeTile() into nbValues values.
+//! @return false if the tile is corrupted.
+template <typename data_t>
+bool decodeTile(const uint8_t * encoded, const BrickTile& tile, data_t * values, std::size_t nbValues) {
+    if(tile.codec == TileCodec::Raw) {
+        if(tile.size != nbValues * sizeof(data_t))
+            return false;
+        std::memcpy(values, encoded, tile.size);
+        return true;
+    }
+
+    const uint8_t * end = encoded + tile.size;
+    data_t previous = 0;
+    std::size_t i = 0;
+    while(i < nbValues && encoded < end) {
+        uint32_t value = 0;
+        int shift = 0;
+        while(encoded < end && (*encoded & 0x80) && shift < 28) {
+            value |= static_cast<uint32_t>(*encoded++ & 0x7f) << shift;
+            shift += 7;
+        }
+        if(encoded == end)
+            return false;
+        value |= static_cast<uint32_t>(*encoded++) << shift;
+
+        if(value & 1) {
+            const std::size_t runLength = (value >> 1) + 1;
+            if(i + runLength > nbValues)
+                return false;
+            std::fill(values + i, values + i + runLength, previous);
+            i += runLength;
+        } else {
+            const uint32_t zigzag = value >> 1;
+            const int32_t delta = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+            previous = static_cast<data_t>(previous + delta);
+            values[i++] = previous;
+        }
+    }
+    return i == nbValues && encoded == end;
+}
+
+//! @brief Write the image read by source as a bricked image, at its original resolution.
+//! The slices are read and compressed in parallel, one layer of bricks at a time.
+//! @param compress If false, all the tiles are stored Raw.
+//! @return false if the file cannot be written, or if the image has several channels or other values than unsigned 8 or 16 bits.
+bool writeBrickedImage(const ImageReader& source, const std::string& filename, bool compress = true);
+
+//! @}
+
+#endif
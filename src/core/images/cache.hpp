@@ -5,6 +5,24 @@
 #define cimg_display 0
 #include "../../third_party/cimg/CImg.h"
 #include <vector>
+#include <type_traits>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Size of the edge of the cubic bricks of BrickedCache, must be a power of two
+#define BRICKED_CACHE_SIZE 8
+// Size of the edge of the cubic bricks of PagedCache
+#define PAGED_CACHE_BRICK_SIZE 32
+// Size of the edge of the cubic bricks of PaletteCache, must be a power of two
+#define PALETTE_CACHE_BRICK_SIZE 16
 
 //! \addtogroup img
 //! @{
@@ -20,43 +38,1016 @@ namespace Interpolation {
     Method fromString(const std::string& method);
     std::string toString(const Interpolation::Method& method);
     std::vector<std::string> toStringList();
+
+    //! @brief Trilinear interpolation of the values given by at(x, y, z), with the same formula as CImg::linear_atXYZ() .
+    //! at() must return 0 outside of the image.
+    template <typename Accessor>
+    float linear(const Accessor& at, const glm::vec3& coord) {
+        const int x = static_cast<int>(std::floor(coord[0]));
+        const int y = static_cast<int>(std::floor(coord[1]));
+        const int z = static_cast<int>(std::floor(coord[2]));
+        const float dx = coord[0] - x;
+        const float dy = coord[1] - y;
+        const float dz = coord[2] - z;
+        const float Iccc = at(x, y, z), Incc = at(x + 1, y, z), Icnc = at(x, y + 1, z), Innc = at(x + 1, y + 1, z);
+        const float Iccn = at(x, y, z + 1), Incn = at(x + 1, y, z + 1), Icnn = at(x, y + 1, z + 1), Innn = at(x + 1, y + 1, z + 1);
+        return Iccc +
+            (Incc - Iccc +
+             (Iccc + Innc - Icnc - Incc +
+              (Iccn + Innn + Icnc + Incc - Icnn - Incn - Iccc - Innc)*dz)*dy +
+             (Iccc + Incn - Iccn - Incc)*dz)*dx +
+            (Icnc - Iccc +
+             (Iccc + Icnn - Iccn - Icnc)*dz)*dy +
+            (Iccn - Iccc)*dz;
+    }
+
+    //! @brief Tricubic (Catmull-Rom) interpolation of the values given by at(x, y, z), with the same formula as CImg::cubic_atXYZ() .
+    //! at() must return 0 outside of the image.
+    template <typename Accessor>
+    float cubic(const Accessor& at, const glm::vec3& coord) {
+        const int x = static_cast<int>(std::floor(coord[0]));
+        const int y = static_cast<int>(std::floor(coord[1]));
+        const int z = static_cast<int>(std::floor(coord[2]));
+        const float dx = coord[0] - x;
+        const float dy = coord[1] - y;
+        const float dz = coord[2] - z;
+        auto catmullRom = [](float Ip, float Ic, float In, float Ia, float d) {
+            return Ic + 0.5f*(d*(-Ip + In) + d*d*(2*Ip - 5*Ic + 4*In - Ia) + d*d*d*(-Ip + 3*Ic - 3*In + Ia));
+        };
+        // Interpolated along x, then y, then z
+        float planes[4];
+        for(int k = 0; k < 4; ++k) {
+            float rows[4];
+            for(int j = 0; j < 4; ++j) {
+                const int ny = y + j - 1;
+                const int nz = z + k - 1;
+                rows[j] = catmullRom(at(x - 1, ny, nz), at(x, ny, nz), at(x + 1, ny, nz), at(x + 2, ny, nz), dx);
+            }
+            planes[k] = catmullRom(rows[0], rows[1], rows[2], rows[3], dy);
+        }
+        return catmullRom(planes[0], planes[1], planes[2], planes[3], dz);
+    }
+
+    //! @brief Value at coord of the image of type data_t whose values are given by at(x, y, z), as CImgCache::getValue() .
+    template <typename data_t, typename Accessor>
+    uint16_t interpolate(const Accessor& at, const glm::vec3& coord, Method interpolationMethod) {
+        if(interpolationMethod == Method::Linear) {
+            return static_cast<uint16_t>(linear(at, coord));
+        } else if (interpolationMethod == Method::Cubic) {
+            // Clamped to the range of data_t, as CImg::cubic_atXYZ_c()
+            const float value = std::min(std::max(cubic(at, coord), 0.f), static_cast<float>(std::numeric_limits<data_t>::max()));
+            return static_cast<uint16_t>(static_cast<data_t>(value));
+        } else {
+            return static_cast<uint16_t>(at(static_cast<int>(coord[0]), static_cast<int>(coord[1]), static_cast<int>(coord[2])));
+        }
+    }
+}
+
+//! @brief Value of the voxel (x, y, z) of the coarser level of an image of the given size, whose values are given by at(x, y, z),
+//! see Cache::buildCoarserLevel() .
+template <typename data_t, typename Accessor>
+data_t getCoarserLevelValue(const Accessor& at, int x, int y, int z, const glm::ivec3& size, bool average) {
+    if(!average)
+        return at(2 * x, 2 * y, 2 * z);
+    // Blocks on the borders may have less than 8 values
+    uint32_t sum = 0;
+    uint32_t nbValues = 0;
+    for(int k = 2 * z; k < std::min(2 * z + 2, size.z); ++k) {
+        for(int j = 2 * y; j < std::min(2 * y + 2, size.y); ++j) {
+            for(int i = 2 * x; i < std::min(2 * x + 2, size.x); ++i) {
+                sum += at(i, j, k);
+                ++nbValues;
+            }
+        }
+    }
+    return static_cast<data_t>((sum + nbValues / 2) / nbValues);
 }
 
 using namespace cimg_library;
 
-//! @brief Store an image into a CImg structure. Storing the image in a CImg allows access to many features, like interpolation.
+//! @brief Interface of the caches storing the values of a Sampler.
+//! Values are given and returned on 16 bits, but each implementation is free to store them with a lower bit depth.
+//! Slices are given and returned with the getNbChannels() channels of each voxel next to each other.
 struct Cache {
-    CImg<uint16_t> img;
+    virtual ~Cache() {}
+
+    virtual void storeImage(int imageIdx, const std::vector<uint8_t>& data) = 0;
+    virtual void storeImage(int imageIdx, const std::vector<uint16_t>& data) = 0;
+
+    virtual void reset() = 0;
+
+    //! @brief Value of the first channel.
+    virtual uint16_t getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod) = 0;
+
+    //! @brief Same as getValue() for nbPoints points at once, which allows the implementations to vectorize the interpolation.
+    virtual void getValues(const glm::vec3 * coords, std::size_t nbPoints, Interpolation::Method interpolationMethod, uint16_t * values) {
+        for(std::size_t i = 0; i < nbPoints; ++i)
+            values[i] = this->getValue(coords[i], interpolationMethod);
+    }
+
+    //! @brief Copy a slice of the cache at the end of data.
+    virtual void getImage(int imageIdx, std::vector<uint8_t>& data) const = 0;
+    virtual void getImage(int imageIdx, std::vector<uint16_t>& data) const = 0;
+
+    virtual glm::vec3 getSize() const = 0;
+    virtual int getNbChannels() const = 0;
+
+    //! @brief Build the next level of a multi-resolution pyramid: a cache of the same type with half the resolution on each axis,
+    //! rounded up. Each value is the mean of the 2x2x2 values it replaces if average is true, the first of them otherwise.
+    virtual Cache * buildCoarserLevel(bool average) const = 0;
+};
+
+//! @brief Store an image into a CImg structure. Storing the image in a CImg allows access to many features, like interpolation.
+//! The channels are stored in the spectrum of the CImg, each channel is stored once.
+//! @tparam data_t Type used to store the values, uint8_t for 8 bits images halves the memory used compared to uint16_t.
+template <typename data_t>
+struct CImgCache : public Cache {
+    CImg<data_t> img;
+
+    CImgCache(glm::vec3 imageSize, int nbChannels = 1): img(CImg<data_t>(imageSize[0], imageSize[1], imageSize[2], nbChannels, 0)) {}
+
+    void storeImage(int imageIdx, const std::vector<uint8_t>& data) override {
+        this->storeSlice(imageIdx, data);
+    }
+
+    void storeImage(int imageIdx, const std::vector<uint16_t>& data) override {
+        this->storeSlice(imageIdx, data);
+    }
+
+    void reset() override {
+        this->img = CImg<data_t>(this->img.width(), this->img.height(), this->img.depth(), this->img.spectrum(), 0);
+    }
+
+    void getImage(int imageIdx, std::vector<uint8_t>& data) const override {
+        this->copySlice(imageIdx, data);
+    }
+
+    void getImage(int imageIdx, std::vector<uint16_t>& data) const override {
+        this->copySlice(imageIdx, data);
+    }
 
-    Cache(glm::vec3 imageSize);
+    glm::vec3 getSize() const override {
+        return glm::vec3(this->img.width(), this->img.height(), this->img.depth());
+    }
 
-    void storeImage(int imageIdx, const std::vector<uint16_t>& data);
+    int getNbChannels() const override {
+        return this->img.spectrum();
+    }
 
-    void reset();
+    Cache * buildCoarserLevel(bool average) const override {
+        const int width = (this->img.width() + 1) / 2;
+        const int height = (this->img.height() + 1) / 2;
+        const int depth = (this->img.depth() + 1) / 2;
+        const int nbChannels = this->img.spectrum();
+        CImgCache<data_t> * level = new CImgCache<data_t>(glm::vec3(width, height, depth), nbChannels);
+        #pragma omp parallel for schedule(dynamic) collapse(2)
+        for(int c = 0; c < nbChannels; ++c) {
+            for(int z = 0; z < depth; ++z) {
+                for(int y = 0; y < height; ++y) {
+                    for(int x = 0; x < width; ++x) {
+                        if(!average) {
+                            level->img(x, y, z, c) = this->img(2 * x, 2 * y, 2 * z, c);
+                            continue;
+                        }
+                        // Blocks on the borders may have less than 8 values
+                        uint32_t sum = 0;
+                        uint32_t nbValues = 0;
+                        for(int k = 2 * z; k < std::min(2 * z + 2, this->img.depth()); ++k) {
+                            for(int j = 2 * y; j < std::min(2 * y + 2, this->img.height()); ++j) {
+                                for(int i = 2 * x; i < std::min(2 * x + 2, this->img.width()); ++i) {
+                                    sum += this->img(i, j, k, c);
+                                    ++nbValues;
+                                }
+                            }
+                        }
+                        level->img(x, y, z, c) = static_cast<data_t>((sum + nbValues / 2) / nbValues);
+                    }
+                }
+            }
+        }
+        return level;
+    }
 
-    uint16_t getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod);
+    uint16_t getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod) override {
+        if(coord[0]<0 || coord[1]<0 || coord[2]<0 || coord[0]>=this->img.width() || coord[1]>=this->img.height() || coord[2]>=this->img.depth()) return static_cast<uint16_t>(0);
+        if(interpolationMethod == Interpolation::Method::Linear) {
+            return static_cast<uint16_t>(this->img.linear_atXYZ(coord[0], coord[1], coord[2], 0, static_cast<data_t>(0)));
+        } else if (interpolationMethod == Interpolation::Method::Cubic) {
+            return static_cast<uint16_t>(this->img.cubic_atXYZ_c(coord[0], coord[1], coord[2], 0, static_cast<data_t>(0)));
+        } else {
+            return static_cast<uint16_t>(this->img.atXYZ(coord[0], coord[1], coord[2]));
+        }
+    }
+
+private:
+    template <typename out_data_t>
+    void copySlice(int imageIdx, std::vector<out_data_t>& data) const {
+        const std::size_t sliceSize = static_cast<std::size_t>(this->img.width()) * this->img.height();
+        const int nbChannels = this->img.spectrum();
+        if(nbChannels > 1) {
+            // Channels are interleaved back
+            const std::size_t insertIdx = data.size();
+            data.resize(insertIdx + sliceSize * nbChannels);
+            for(int c = 0; c < nbChannels; ++c) {
+                const data_t * slice = this->img.data(0, 0, imageIdx, c);
+                for(std::size_t i = 0; i < sliceSize; ++i)
+                    data[insertIdx + i * nbChannels + c] = slice[i];
+            }
+            return;
+        }
+        const data_t * slice = this->img.data(0, 0, imageIdx);
+        data.insert(data.end(), slice, slice + sliceSize);
+    }
+
+    template <typename in_data_t>
+    void storeSlice(int imageIdx, const std::vector<in_data_t>& data) {
+        const int nbChannels = this->img.spectrum();
+        if(nbChannels > 1) {
+            // Each channel of the interleaved slice goes to its own plane
+            const std::size_t nbVoxels = std::min(data.size() / nbChannels, static_cast<std::size_t>(this->img.width()) * this->img.height());
+            for(int c = 0; c < nbChannels; ++c) {
+                data_t * slice = this->img.data(0, 0, imageIdx, c);
+                for(std::size_t i = 0; i < nbVoxels; ++i)
+                    slice[i] = static_cast<data_t>(data[i * nbChannels + c]);
+            }
+        } else if constexpr (std::is_same<in_data_t, data_t>::value) {
+            this->img.get_shared_slice(imageIdx).assign(data.data(), this->img.width(), this->img.height(), 1.);
+        } else {
+            // The values are expected to fit in data_t
+            data_t * slice = this->img.data(0, 0, imageIdx);
+            const std::size_t nbValues = std::min(data.size(), static_cast<std::size_t>(this->img.width()) * this->img.height());
+            #pragma omp simd
+            for(std::size_t i = 0; i < nbValues; ++i)
+                slice[i] = static_cast<data_t>(data[i]);
+        }
+    }
 };
 
-//! @brief Unlike Cache, this %cache implementation allows to store parts of the image only, saving memory. However it do no allow interpolation this is it is currently unused.
-struct UnsortedCache {
-    // Maximum number of slices to be stored
-    int capacity;
-    int nbInsertion;
-    glm::vec3 imageSize;
+//! @brief Store an image as cubic bricks of BRICKED_CACHE_SIZE voxels, with the voxels of each brick in Morton (Z) order.
+//!
+//! Unlike CImgCache, where two neighbours along y or z are a whole row or slice apart, the neighbours of a voxel along every axis
+//! are most often in the same brick, i.e. in the same few cache lines and in the same page. The interpolations, the slices
+//! resampled along any axis and the threads sampling distinct regions then touch much less memory.
+//! The address of a voxel is the sum of three precomputed offsets, one per axis, so no division is needed to find it.
+//! The image is padded with zeros up to a whole number of bricks, each channel is stored in its own set of bricks.
+//! @tparam data_t Type used to store the values, see CImgCache .
+template <typename data_t>
+struct BrickedCache : public Cache {
+
+    BrickedCache(glm::vec3 imageSize, int nbChannels = 1): size(imageSize), nbChannels(nbChannels) {
+        const glm::ivec3 nbBricks = (glm::ivec3(imageSize) + BRICKED_CACHE_SIZE - 1) / BRICKED_CACHE_SIZE;
+        const std::size_t brickVolume = BRICKED_CACHE_SIZE * BRICKED_CACHE_SIZE * BRICKED_CACHE_SIZE;
+        const std::size_t strides[3] = {brickVolume, brickVolume * nbBricks.x, brickVolume * nbBricks.x * nbBricks.y};
+        for(int axis = 0; axis < 3; ++axis) {
+            this->offsets[axis].resize(static_cast<int>(imageSize[axis]));
+            for(int i = 0; i < static_cast<int>(imageSize[axis]); ++i) {
+                // Interleave the bits of the position in the brick, x first
+                std::size_t morton = 0;
+                for(int bit = 0; (1 << bit) < BRICKED_CACHE_SIZE; ++bit)
+                    morton |= static_cast<std::size_t>(((i % BRICKED_CACHE_SIZE) >> bit) & 1) << (3 * bit + axis);
+                this->offsets[axis][i] = (i / BRICKED_CACHE_SIZE) * strides[axis] + morton;
+            }
+        }
+        this->channelSize = strides[2] * nbBricks.z;
+        // The vectorized getValues() reads 4 bytes at the address of each value
+        this->data.assign(this->channelSize * nbChannels + 4, 0);
+    }
+
+    void storeImage(int imageIdx, const std::vector<uint8_t>& data) override {
+        this->storeSlice(imageIdx, data);
+    }
+
+    void storeImage(int imageIdx, const std::vector<uint16_t>& data) override {
+        this->storeSlice(imageIdx, data);
+    }
+
+    void reset() override {
+        std::fill(this->data.begin(), this->data.end(), 0);
+    }
+
+    void getImage(int imageIdx, std::vector<uint8_t>& data) const override {
+        this->copySlice(imageIdx, data);
+    }
+
+    void getImage(int imageIdx, std::vector<uint16_t>& data) const override {
+        this->copySlice(imageIdx, data);
+    }
+
+    glm::vec3 getSize() const override {
+        return this->size;
+    }
+
+    int getNbChannels() const override {
+        return this->nbChannels;
+    }
+
+    //! @brief Value of a voxel, 0 outside of the image.
+    data_t at(int x, int y, int z, int c = 0) const {
+        if(x < 0 || y < 0 || z < 0 || x >= this->size[0] || y >= this->size[1] || z >= this->size[2])
+            return 0;
+        return this->data[c * this->channelSize + this->offsets[0][x] + this->offsets[1][y] + this->offsets[2][z]];
+    }
+
+    Cache * buildCoarserLevel(bool average) const override {
+        const glm::ivec3 size(this->size);
+        const glm::ivec3 levelSize = (size + 1) / 2;
+        BrickedCache<data_t> * level = new BrickedCache<data_t>(glm::vec3(levelSize), this->nbChannels);
+        #pragma omp parallel for schedule(dynamic) collapse(2)
+        for(int c = 0; c < this->nbChannels; ++c) {
+            for(int z = 0; z < levelSize.z; ++z) {
+                for(int y = 0; y < levelSize.y; ++y) {
+                    for(int x = 0; x < levelSize.x; ++x) {
+                        auto at = [this, c](int i, int j, int k) { return this->at(i, j, k, c); };
+                        level->data[c * level->channelSize + level->offsets[0][x] + level->offsets[1][y] + level->offsets[2][z]] = getCoarserLevelValue<data_t>(at, x, y, z, size, average);
+                    }
+                }
+            }
+        }
+        return level;
+    }
+
+    uint16_t getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod) override {
+        if(coord[0]<0 || coord[1]<0 || coord[2]<0 || coord[0]>=this->size[0] || coord[1]>=this->size[1] || coord[2]>=this->size[2]) return static_cast<uint16_t>(0);
+        auto at = [this](int x, int y, int z) { return static_cast<float>(this->at(x, y, z)); };
+        return Interpolation::interpolate<data_t>(at, coord, interpolationMethod);
+    }
+
+    //! @brief The points are interpolated 8 at a time with AVX2 if it is available, the results are the same as getValue().
+    void getValues(const glm::vec3 * coords, std::size_t nbPoints, Interpolation::Method interpolationMethod, uint16_t * values) override {
+        std::size_t i = 0;
+#ifdef __AVX2__
+        i = this->getValuesAVX2(coords, nbPoints, interpolationMethod, values);
+#endif
+        // The method is chosen once for all the points, and the neighbours of the points far from the borders are read without bounds checks
+        const glm::ivec3 size(this->size);
+        auto atInside = [this](int x, int y, int z) { return static_cast<float>(this->data[this->offsets[0][x] + this->offsets[1][y] + this->offsets[2][z]]); };
+        auto at = [this](int x, int y, int z) { return static_cast<float>(this->at(x, y, z)); };
+        // The interpolation of a voxel v reads the voxels [v - before, v + after]
+        auto interpolateAll = [&](int before, int after, const auto& interpolate) {
+            for(; i < nbPoints; ++i) {
+                const glm::vec3& coord = coords[i];
+                if(coord[0]<0 || coord[1]<0 || coord[2]<0 || coord[0]>=this->size[0] || coord[1]>=this->size[1] || coord[2]>=this->size[2]) {
+                    values[i] = 0;
+                    continue;
+                }
+                const glm::ivec3 voxel(glm::floor(coord));
+                if(voxel.x >= before && voxel.y >= before && voxel.z >= before && voxel.x + after < size.x && voxel.y + after < size.y && voxel.z + after < size.z)
+                    values[i] = interpolate(atInside, coord);
+                else
+                    values[i] = interpolate(at, coord);
+            }
+        };
+        if(interpolationMethod == Interpolation::Method::Linear) {
+            interpolateAll(0, 1, [](const auto& at, const glm::vec3& coord) { return Interpolation::interpolate<data_t>(at, coord, Interpolation::Method::Linear); });
+        } else if(interpolationMethod == Interpolation::Method::Cubic) {
+            interpolateAll(1, 2, [](const auto& at, const glm::vec3& coord) { return Interpolation::interpolate<data_t>(at, coord, Interpolation::Method::Cubic); });
+        } else {
+            interpolateAll(0, 0, [](const auto& at, const glm::vec3& coord) { return Interpolation::interpolate<data_t>(at, coord, Interpolation::Method::NearestNeighbor); });
+        }
+    }
+
+private:
+    glm::vec3 size;
+    int nbChannels;
+    std::size_t channelSize;
+    //! @brief Offset of each coordinate along each axis, the address of a voxel is the sum of the offsets of its coordinates.
+    std::vector<std::size_t> offsets[3];
+    std::vector<data_t> data;
+
+    template <typename out_data_t>
+    void copySlice(int imageIdx, std::vector<out_data_t>& data) const {
+        const int width = this->size[0];
+        const int height = this->size[1];
+        const std::size_t insertIdx = data.size();
+        data.resize(insertIdx + static_cast<std::size_t>(width) * height * this->nbChannels);
+        out_data_t * slice = data.data() + insertIdx;
+        for(int c = 0; c < this->nbChannels; ++c) {
+            const data_t * channel = this->data.data() + c * this->channelSize + this->offsets[2][imageIdx];
+            for(int y = 0; y < height; ++y) {
+                const data_t * row = channel + this->offsets[1][y];
+                out_data_t * out = slice + static_cast<std::size_t>(y) * width * this->nbChannels + c;
+                for(int x = 0; x < width; ++x)
+                    out[x * this->nbChannels] = row[this->offsets[0][x]];
+            }
+        }
+    }
+
+#ifdef __AVX2__
+    //! @brief getValues() of the points by groups of 8, the values are read with gathers and interpolated with the same operations,
+    //! in the same order, as Interpolation::linear() and Interpolation::cubic() .
+    //! @return The number of points done, the remaining ones are less than 8.
+    std::size_t getValuesAVX2(const glm::vec3 * coords, std::size_t nbPoints, Interpolation::Method interpolationMethod, uint16_t * values) const {
+        static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "The coordinates are read as packed floats");
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i coordIdx = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+        const __m256 sizes[3] = {_mm256_set1_ps(this->size[0]), _mm256_set1_ps(this->size[1]), _mm256_set1_ps(this->size[2])};
+        const __m256i intSizes[3] = {_mm256_set1_epi32(this->size[0]), _mm256_set1_epi32(this->size[1]), _mm256_set1_epi32(this->size[2])};
+        const __m256i maxValue = _mm256_set1_epi32(std::numeric_limits<data_t>::max());
+
+        // Offsets along an axis of 8 voxel coordinates, as two vectors of 4 64 bits offsets, valid is set for the coordinates in the image
+        struct Offsets {
+            __m256i low;
+            __m256i high;
+            __m256i valid;
+        };
+        auto getOffsets = [&](int axis, __m256i coord) {
+            Offsets result;
+            result.valid = _mm256_andnot_si256(_mm256_cmpgt_epi32(zero, coord), _mm256_cmpgt_epi32(intSizes[axis], coord));
+            const __m256i clamped = _mm256_min_epi32(_mm256_max_epi32(coord, zero), _mm256_sub_epi32(intSizes[axis], _mm256_set1_epi32(1)));
+            const long long * table = reinterpret_cast<const long long*>(this->offsets[axis].data());
+            result.low = _mm256_i32gather_epi64(table, _mm256_castsi256_si128(clamped), 8);
+            result.high = _mm256_i32gather_epi64(table, _mm256_extracti128_si256(clamped, 1), 8);
+            return result;
+        };
+        // Values of the voxels at the given offsets along x, y and z, 0 outside of the image
+        auto getVoxels = [&](const Offsets& x, const Offsets& y, const Offsets& z) {
+            const int * base = reinterpret_cast<const int*>(this->data.data());
+            const __m256i valid = _mm256_and_si256(_mm256_and_si256(x.valid, y.valid), z.valid);
+            const __m256i low = _mm256_add_epi64(_mm256_add_epi64(x.low, y.low), z.low);
+            const __m256i high = _mm256_add_epi64(_mm256_add_epi64(x.high, y.high), z.high);
+            const __m128i lowValues = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), base, low, _mm256_castsi256_si128(valid), sizeof(data_t));
+            const __m128i highValues = _mm256_mask_i64gather_epi32(_mm_setzero_si128(), base, high, _mm256_extracti128_si256(valid, 1), sizeof(data_t));
+            return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_set_m128i(highValues, lowValues), maxValue));
+        };
+        auto catmullRom = [](__m256 Ip, __m256 Ic, __m256 In, __m256 Ia, __m256 d) {
+            const __m256 minusIp = _mm256_xor_ps(Ip, _mm256_set1_ps(-0.f));
+            const __m256 d2 = _mm256_mul_ps(d, d);
+            const __m256 d3 = _mm256_mul_ps(d2, d);
+            const __m256 t1 = _mm256_mul_ps(d, _mm256_add_ps(minusIp, In));
+            const __m256 t2 = _mm256_mul_ps(d2, _mm256_sub_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(2.f), Ip), _mm256_mul_ps(_mm256_set1_ps(5.f), Ic)), _mm256_mul_ps(_mm256_set1_ps(4.f), In)), Ia));
+            const __m256 t3 = _mm256_mul_ps(d3, _mm256_add_ps(_mm256_sub_ps(_mm256_add_ps(minusIp, _mm256_mul_ps(_mm256_set1_ps(3.f), Ic)), _mm256_mul_ps(_mm256_set1_ps(3.f), In)), Ia));
+            return _mm256_add_ps(Ic, _mm256_mul_ps(_mm256_set1_ps(0.5f), _mm256_add_ps(_mm256_add_ps(t1, t2), t3)));
+        };
+
+        std::size_t i = 0;
+        for(; i + 8 <= nbPoints; i += 8) {
+            const float * coordsData = &coords[i][0];
+            __m256 coord[3];
+            __m256 inside = _mm256_castsi256_ps(_mm256_cmpeq_epi32(zero, zero));
+            for(int axis = 0; axis < 3; ++axis) {
+                coord[axis] = _mm256_i32gather_ps(coordsData + axis, coordIdx, 4);
+                inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(coord[axis], _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(coord[axis], sizes[axis], _CMP_LT_OQ)));
+            }
+            // The points outside of the image are computed at the origin, and set to 0 afterwards
+            for(int axis = 0; axis < 3; ++axis)
+                coord[axis] = _mm256_and_ps(coord[axis], inside);
+
+            __m256 result;
+            if(interpolationMethod == Interpolation::Method::NearestNeighbor) {
+                result = getVoxels(getOffsets(0, _mm256_cvttps_epi32(coord[0])), getOffsets(1, _mm256_cvttps_epi32(coord[1])), getOffsets(2, _mm256_cvttps_epi32(coord[2])));
+            } else {
+                __m256 d[3];
+                __m256i voxel[3];
+                for(int axis = 0; axis < 3; ++axis) {
+                    const __m256 floor = _mm256_floor_ps(coord[axis]);
+                    voxel[axis] = _mm256_cvttps_epi32(floor);
+                    d[axis] = _mm256_sub_ps(coord[axis], floor);
+                }
+                if(interpolationMethod == Interpolation::Method::Linear) {
+                    Offsets offsets[3][2];
+                    for(int axis = 0; axis < 3; ++axis) {
+                        offsets[axis][0] = getOffsets(axis, voxel[axis]);
+                        offsets[axis][1] = getOffsets(axis, _mm256_add_epi32(voxel[axis], _mm256_set1_epi32(1)));
+                    }
+                    const __m256 Iccc = getVoxels(offsets[0][0], offsets[1][0], offsets[2][0]), Incc = getVoxels(offsets[0][1], offsets[1][0], offsets[2][0]);
+                    const __m256 Icnc = getVoxels(offsets[0][0], offsets[1][1], offsets[2][0]), Innc = getVoxels(offsets[0][1], offsets[1][1], offsets[2][0]);
+                    const __m256 Iccn = getVoxels(offsets[0][0], offsets[1][0], offsets[2][1]), Incn = getVoxels(offsets[0][1], offsets[1][0], offsets[2][1]);
+                    const __m256 Icnn = getVoxels(offsets[0][0], offsets[1][1], offsets[2][1]), Innn = getVoxels(offsets[0][1], offsets[1][1], offsets[2][1]);
+                    const __m256 dx = d[0], dy = d[1], dz = d[2];
+                    auto add = [](__m256 a, __m256 b) { return _mm256_add_ps(a, b); };
+                    auto sub = [](__m256 a, __m256 b) { return _mm256_sub_ps(a, b); };
+                    auto mul = [](__m256 a, __m256 b) { return _mm256_mul_ps(a, b); };
+                    const __m256 R = sub(sub(sub(sub(add(add(add(Iccn, Innn), Icnc), Incc), Icnn), Incn), Iccc), Innc);
+                    const __m256 P = add(sub(sub(add(Iccc, Innc), Icnc), Incc), mul(R, dz));
+                    const __m256 Q = sub(sub(add(Iccc, Incn), Iccn), Incc);
+                    const __m256 A = add(add(sub(Incc, Iccc), mul(P, dy)), mul(Q, dz));
+                    const __m256 S = sub(sub(add(Iccc, Icnn), Iccn), Icnc);
+                    const __m256 B = add(sub(Icnc, Iccc), mul(S, dz));
+                    result = add(add(add(Iccc, mul(A, dx)), mul(B, dy)), mul(sub(Iccn, Iccc), dz));
+                } else {
+                    Offsets offsets[3][4];
+                    for(int axis = 0; axis < 3; ++axis) {
+                        for(int n = 0; n < 4; ++n)
+                            offsets[axis][n] = getOffsets(axis, _mm256_add_epi32(voxel[axis], _mm256_set1_epi32(n - 1)));
+                    }
+                    __m256 planes[4];
+                    for(int k = 0; k < 4; ++k) {
+                        __m256 rows[4];
+                        for(int j = 0; j < 4; ++j) {
+                            rows[j] = catmullRom(getVoxels(offsets[0][0], offsets[1][j], offsets[2][k]), getVoxels(offsets[0][1], offsets[1][j], offsets[2][k]),
+                                                 getVoxels(offsets[0][2], offsets[1][j], offsets[2][k]), getVoxels(offsets[0][3], offsets[1][j], offsets[2][k]), d[0]);
+                        }
+                        planes[k] = catmullRom(rows[0], rows[1], rows[2], rows[3], d[1]);
+                    }
+                    result = catmullRom(planes[0], planes[1], planes[2], planes[3], d[2]);
+                    // Clamped to the range of data_t, as CImg::cubic_atXYZ_c()
+                    result = _mm256_min_ps(_mm256_max_ps(result, _mm256_setzero_ps()), _mm256_set1_ps(std::numeric_limits<data_t>::max()));
+                }
+            }
+
+            alignas(32) int32_t results[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(results), _mm256_and_si256(_mm256_cvttps_epi32(result), _mm256_castps_si256(inside)));
+            for(int lane = 0; lane < 8; ++lane)
+                values[i + lane] = static_cast<uint16_t>(results[lane]);
+        }
+        return i;
+    }
+#endif
+
+    template <typename in_data_t>
+    void storeSlice(int imageIdx, const std::vector<in_data_t>& data) {
+        // The values are expected to fit in data_t
+        const int width = this->size[0];
+        const int height = std::min<std::size_t>(this->size[1], data.size() / (static_cast<std::size_t>(width) * this->nbChannels));
+        for(int c = 0; c < this->nbChannels; ++c) {
+            data_t * channel = this->data.data() + c * this->channelSize + this->offsets[2][imageIdx];
+            for(int y = 0; y < height; ++y) {
+                data_t * row = channel + this->offsets[1][y];
+                const in_data_t * in = data.data() + static_cast<std::size_t>(y) * width * this->nbChannels + c;
+                for(int x = 0; x < width; ++x)
+                    row[this->offsets[0][x]] = static_cast<data_t>(in[x * this->nbChannels]);
+            }
+        }
+    }
+};
+
+//! @brief Lossless compressed cache for the segmented images, whose labels come in large regions of the same value.
+//!
+//! The image is cut in cubic bricks of PALETTE_CACHE_BRICK_SIZE voxels. Each brick stores the distinct values it contains, its palette,
+//! and the index of the value of each voxel in the palette, packed on the smallest number of bits among 0, 1, 2, 4, 8 and 16.
+//! A brick of a single label then takes a few bytes, and a brick on the border of two labels one bit per voxel, but a voxel is still
+//! read with a few shifts and no decoding, so that the nearest neighbour sampling stays as fast as with an uncompressed cache.
+//! The slices stored are kept uncompressed until all the slices of their layer of bricks are stored, the layers are then compressed
+//! by the thread which stored the last slice. Any number of threads can store distinct slices at once.
+//! \note The values of a layer can only be read once all its slices are stored.
+//! @tparam data_t Type used to store the values, see CImgCache .
+template <typename data_t>
+struct PaletteCache : public Cache {
+
+    PaletteCache(glm::vec3 imageSize, int nbChannels = 1): size(imageSize), nbChannels(nbChannels) {
+        this->nbBricks = (glm::ivec3(imageSize) + PALETTE_CACHE_BRICK_SIZE - 1) / PALETTE_CACHE_BRICK_SIZE;
+        this->bricks.resize(static_cast<std::size_t>(this->nbBricks.x) * this->nbBricks.y * this->nbBricks.z * nbChannels);
+        this->layers.resize(this->nbBricks.z);
+    }
+
+    void storeImage(int imageIdx, const std::vector<uint8_t>& data) override {
+        this->storeSlice(imageIdx, data);
+    }
+
+    void storeImage(int imageIdx, const std::vector<uint16_t>& data) override {
+        this->storeSlice(imageIdx, data);
+    }
+
+    void reset() override {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::fill(this->bricks.begin(), this->bricks.end(), Brick());
+        for(std::unique_ptr<Layer>& layer : this->layers)
+            layer.reset();
+    }
+
+    void getImage(int imageIdx, std::vector<uint8_t>& data) const override {
+        this->copySlice(imageIdx, data);
+    }
+
+    void getImage(int imageIdx, std::vector<uint16_t>& data) const override {
+        this->copySlice(imageIdx, data);
+    }
+
+    glm::vec3 getSize() const override {
+        return this->size;
+    }
+
+    int getNbChannels() const override {
+        return this->nbChannels;
+    }
+
+    //! @brief Value of a voxel, 0 outside of the image.
+    data_t at(int x, int y, int z, int c = 0) const {
+        if(x < 0 || y < 0 || z < 0 || x >= this->size[0] || y >= this->size[1] || z >= this->size[2])
+            return 0;
+        const int brickSize = PALETTE_CACHE_BRICK_SIZE;
+        const Brick& brick = this->bricks[this->getBrickIdx(x / brickSize, y / brickSize, z / brickSize, c)];
+        return brick.getValue((static_cast<std::size_t>(z % brickSize) * brickSize + y % brickSize) * brickSize + x % brickSize);
+    }
+
+    //! @brief Size in bytes of the compressed bricks.
+    std::size_t getMemory() const {
+        std::size_t memory = 0;
+        for(const Brick& brick : this->bricks)
+            memory += sizeof(Brick) + brick.palette.size() * sizeof(data_t) + brick.indices.size() * sizeof(uint32_t);
+        return memory;
+    }
+
+    Cache * buildCoarserLevel(bool average) const override {
+        const glm::ivec3 size(this->size);
+        const glm::ivec3 levelSize = (size + 1) / 2;
+        PaletteCache<data_t> * level = new PaletteCache<data_t>(glm::vec3(levelSize), this->nbChannels);
+        #pragma omp parallel
+        {
+            std::vector<data_t> slice;
+            #pragma omp for schedule(dynamic, PALETTE_CACHE_BRICK_SIZE)
+            for(int z = 0; z < levelSize.z; ++z) {
+                slice.clear();
+                for(int y = 0; y < levelSize.y; ++y) {
+                    for(int x = 0; x < levelSize.x; ++x) {
+                        for(int c = 0; c < this->nbChannels; ++c) {
+                            auto at = [this, c](int i, int j, int k) { return this->at(i, j, k, c); };
+                            slice.push_back(getCoarserLevelValue<data_t>(at, x, y, z, size, average));
+                        }
+                    }
+                }
+                level->storeImage(z, slice);
+            }
+        }
+        return level;
+    }
+
+    uint16_t getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod) override {
+        if(coord[0]<0 || coord[1]<0 || coord[2]<0 || coord[0]>=this->size[0] || coord[1]>=this->size[1] || coord[2]>=this->size[2]) return static_cast<uint16_t>(0);
+        auto at = [this](int x, int y, int z) { return static_cast<float>(this->at(x, y, z)); };
+        return Interpolation::interpolate<data_t>(at, coord, interpolationMethod);
+    }
+
+private:
+    struct Brick {
+        //! @brief Distinct values of the brick, sorted.
+        std::vector<data_t> palette{0};
+        //! @brief Index in the palette of each voxel, x first, on bits bits. A word holds 32 / bits indices.
+        std::vector<uint32_t> indices;
+        int bits = 0;
+
+        data_t getValue(std::size_t voxelIdx) const {
+            if(this->bits == 0)
+                return this->palette[0];
+            const std::size_t bit = voxelIdx * this->bits;
+            return this->palette[(this->indices[bit >> 5] >> (bit & 31)) & ((1u << this->bits) - 1)];
+        }
+    };
+
+    //! @brief Uncompressed values of a layer of bricks whose slices are being stored, padded to whole bricks.
+    struct Layer {
+        std::vector<data_t> values;
+        int nbStored = 0;
+    };
+
+    glm::vec3 size;
+    int nbChannels;
+    glm::ivec3 nbBricks;
+    //! @brief x first, then y, then z, each channel has its own set of bricks.
+    std::vector<Brick> bricks;
+    //! @brief The layers being stored, nullptr for the other ones.
+    std::vector<std::unique_ptr<Layer>> layers;
+    //! @brief Protects layers.
+    std::mutex mutex;
+
+    std::size_t getBrickIdx(int x, int y, int z, int c) const {
+        return ((static_cast<std::size_t>(c) * this->nbBricks.z + z) * this->nbBricks.y + y) * this->nbBricks.x + x;
+    }
+
+    //! @brief Index of a voxel of a layer in Layer::values, z is relative to the layer.
+    std::size_t getLayerIdx(int x, int y, int z, int c) const {
+        const int brickSize = PALETTE_CACHE_BRICK_SIZE;
+        return ((static_cast<std::size_t>(c) * brickSize + z) * this->nbBricks.y * brickSize + y) * this->nbBricks.x * brickSize + x;
+    }
+
+    template <typename in_data_t>
+    void storeSlice(int imageIdx, const std::vector<in_data_t>& data) {
+        const int brickSize = PALETTE_CACHE_BRICK_SIZE;
+        const int layerIdx = imageIdx / brickSize;
+        const int width = this->size[0];
+        // The rows missing from a short slice keep their previous values
+        const int height = std::min<std::size_t>(this->size[1], data.size() / (static_cast<std::size_t>(width) * this->nbChannels));
+        Layer * layer = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if(!this->layers[layerIdx]) {
+                this->layers[layerIdx].reset(new Layer());
+                this->decompressLayer(layerIdx, this->layers[layerIdx]->values);
+            }
+            layer = this->layers[layerIdx].get();
+        }
+        // Each slice is a distinct region of the layer, no lock is needed
+        for(int c = 0; c < this->nbChannels; ++c) {
+            for(int y = 0; y < height; ++y) {
+                data_t * row = layer->values.data() + this->getLayerIdx(0, y, imageIdx % brickSize, c);
+                const in_data_t * in = data.data() + static_cast<std::size_t>(y) * width * this->nbChannels + c;
+                for(int x = 0; x < width; ++x)
+                    row[x] = static_cast<data_t>(in[x * this->nbChannels]);
+            }
+        }
+        std::unique_ptr<Layer> complete;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            const int nbSlices = std::min(brickSize, static_cast<int>(this->size[2]) - layerIdx * brickSize);
+            if(++layer->nbStored >= nbSlices)
+                complete = std::move(this->layers[layerIdx]);
+        }
+        if(complete)
+            this->compressLayer(layerIdx, complete->values);
+    }
+
+    //! @brief Called with mutex locked, copy the bricks of a layer into values.
+    void decompressLayer(int layerIdx, std::vector<data_t>& values) const {
+        const int brickSize = PALETTE_CACHE_BRICK_SIZE;
+        values.assign(this->getLayerIdx(0, 0, 0, this->nbChannels), 0);
+        for(int c = 0; c < this->nbChannels; ++c) {
+            for(int brickY = 0; brickY < this->nbBricks.y; ++brickY) {
+                for(int brickX = 0; brickX < this->nbBricks.x; ++brickX) {
+                    const Brick& brick = this->bricks[this->getBrickIdx(brickX, brickY, layerIdx, c)];
+                    if(brick.bits == 0 && brick.palette[0] == 0)
+                        continue;
+                    std::size_t voxelIdx = 0;
+                    for(int z = 0; z < brickSize; ++z)
+                        for(int y = 0; y < brickSize; ++y)
+                            for(int x = 0; x < brickSize; ++x)
+                                values[this->getLayerIdx(brickX * brickSize + x, brickY * brickSize + y, z, c)] = brick.getValue(voxelIdx++);
+                }
+            }
+        }
+    }
+
+    void compressLayer(int layerIdx, const std::vector<data_t>& values) {
+        const int brickSize = PALETTE_CACHE_BRICK_SIZE;
+        const std::size_t brickVolume = static_cast<std::size_t>(brickSize) * brickSize * brickSize;
+        std::vector<data_t> brickValues(brickVolume);
+        // Index in the palette of each value
+        std::vector<uint16_t> paletteIdx(std::size_t(1) << (sizeof(data_t) * 8));
+        for(int c = 0; c < this->nbChannels; ++c) {
+            for(int brickY = 0; brickY < this->nbBricks.y; ++brickY) {
+                for(int brickX = 0; brickX < this->nbBricks.x; ++brickX) {
+                    std::size_t voxelIdx = 0;
+                    for(int z = 0; z < brickSize; ++z) {
+                        for(int y = 0; y < brickSize; ++y) {
+                            const data_t * row = values.data() + this->getLayerIdx(brickX * brickSize, brickY * brickSize + y, z, c);
+                            std::copy(row, row + brickSize, brickValues.data() + voxelIdx);
+                            voxelIdx += brickSize;
+                        }
+                    }
+
+                    Brick brick;
+                    brick.palette = brickValues;
+                    std::sort(brick.palette.begin(), brick.palette.end());
+                    brick.palette.erase(std::unique(brick.palette.begin(), brick.palette.end()), brick.palette.end());
+                    brick.palette.shrink_to_fit();
+                    while((std::size_t(1) << brick.bits) < brick.palette.size())
+                        brick.bits = (brick.bits == 0) ? 1 : brick.bits * 2;
+                    if(brick.bits > 0) {
+                        for(std::size_t i = 0; i < brick.palette.size(); ++i)
+                            paletteIdx[brick.palette[i]] = static_cast<uint16_t>(i);
+                        brick.indices.assign(brickVolume * brick.bits / 32, 0);
+                        for(std::size_t i = 0; i < brickVolume; ++i) {
+                            const std::size_t bit = i * brick.bits;
+                            brick.indices[bit >> 5] |= static_cast<uint32_t>(paletteIdx[brickValues[i]]) << (bit & 31);
+                        }
+                    }
+                    this->bricks[this->getBrickIdx(brickX, brickY, layerIdx, c)] = std::move(brick);
+                }
+            }
+        }
+    }
+
+    template <typename out_data_t>
+    void copySlice(int imageIdx, std::vector<out_data_t>& data) const {
+        const int width = this->size[0];
+        const int height = this->size[1];
+        const std::size_t insertIdx = data.size();
+        data.resize(insertIdx + static_cast<std::size_t>(width) * height * this->nbChannels);
+        out_data_t * slice = data.data() + insertIdx;
+        for(int y = 0; y < height; ++y) {
+            for(int x = 0; x < width; ++x) {
+                for(int c = 0; c < this->nbChannels; ++c)
+                    *slice++ = this->at(x, y, imageIdx, c);
+            }
+        }
+    }
+};
+
+//! @brief Out-of-core cache: the image is cut in cubic bricks of PAGED_CACHE_BRICK_SIZE voxels, which are read on demand by a loader
+//! and kept in memory up to a capacity, so that images larger than the RAM can be sampled.
+//!
+//! When the bricks exceed the capacity, the least recently used ones are dropped, down to 3/4 of the capacity so that the cost of
+//! an eviction is shared by many loads. Any number of threads can read the cache at once: the bricks are immutable and replaced
+//! atomically, a brick dropped while a thread reads it stays valid for this thread. Each thread keeps the last brick it used,
+//! so that the successive accesses to a brick, e.g. the values of an interpolation, do not need any synchronization.
+//! The coarser levels are paged caches too, whose bricks are computed from the bricks of the finer level.
+//! The bricks known to be background, e.g. from an OccupancyMap, are not loaded: they all share a single brick of zeros.
+//! \note The values are given by the loader, storeImage() do nothing.
+template <typename data_t>
+struct PagedCache : public Cache {
+    using Brick = std::shared_ptr<const std::vector<data_t>>;
+    //! @brief Append the values of the area [min, max[ of the image to values, x first, with the channels of each voxel next to each other.
+    //! It is called by several threads at once.
+    using Loader = std::function<void(const glm::ivec3& min, const glm::ivec3& max, std::vector<data_t>& values)>;
+    //! @brief True if the area [min, max[ of the image is only background, which is then read as 0. It is called by several threads at once.
+    using EmptyTest = std::function<bool(const glm::ivec3& min, const glm::ivec3& max)>;
+
+    //! @param capacity Size in bytes of the bricks kept in memory.
+    //! @param isEmpty Optional, the bricks for which it returns true are not loaded.
+    PagedCache(glm::vec3 imageSize, int nbChannels, std::size_t capacity, Loader loader, EmptyTest isEmpty = nullptr):
+        size(imageSize), nbChannels(nbChannels), capacity(capacity), loader(loader), isEmpty(isEmpty), residentSize(0), clock(0), id(PagedCache<data_t>::getNextId()) {
+        this->nbBricks = (glm::ivec3(imageSize) + PAGED_CACHE_BRICK_SIZE - 1) / PAGED_CACHE_BRICK_SIZE;
+        this->slots.reset(new Slot[static_cast<std::size_t>(this->nbBricks.x) * this->nbBricks.y * this->nbBricks.z]);
+        if(this->isEmpty)
+            this->emptyBrick = std::make_shared<const std::vector<data_t>>(this->getBrickMemory() / sizeof(data_t), 0);
+    }
+
+    void storeImage(int imageIdx, const std::vector<uint8_t>& data) override {}
+
+    void storeImage(int imageIdx, const std::vector<uint16_t>& data) override {}
+
+    //! @brief Drop all the bricks.
+    void reset() override {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for(std::size_t brickIdx : this->resident)
+            std::atomic_store(&this->slots[brickIdx].brick, Brick());
+        this->resident.clear();
+        this->residentSize = 0;
+    }
+
+    void getImage(int imageIdx, std::vector<uint8_t>& data) const override {
+        this->copySlice(imageIdx, data);
+    }
+
+    void getImage(int imageIdx, std::vector<uint16_t>& data) const override {
+        this->copySlice(imageIdx, data);
+    }
+
+    glm::vec3 getSize() const override {
+        return this->size;
+    }
+
+    int getNbChannels() const override {
+        return this->nbChannels;
+    }
+
+    //! @brief Value of a voxel, 0 outside of the image. Its brick is loaded if needed.
+    data_t at(int x, int y, int z, int c = 0) const {
+        if(x < 0 || y < 0 || z < 0 || x >= this->size[0] || y >= this->size[1] || z >= this->size[2])
+            return 0;
+        const int brickSize = PAGED_CACHE_BRICK_SIZE;
+        const std::size_t brickIdx = (static_cast<std::size_t>(z / brickSize) * this->nbBricks.y + y / brickSize) * this->nbBricks.x + x / brickSize;
+        const std::vector<data_t>& brick = this->getBrick(brickIdx);
+        return brick[((static_cast<std::size_t>(c) * brickSize + z % brickSize) * brickSize + y % brickSize) * brickSize + x % brickSize];
+    }
+
+    //! @brief The level is computed brick by brick when it is read, with 1/8 of the capacity of this cache.
+    //! \warning The level reads this cache, which must outlive it.
+    Cache * buildCoarserLevel(bool average) const override {
+        const glm::ivec3 size(this->size);
+        const PagedCache<data_t> * finer = this;
+        Loader loader = [finer, size, average](const glm::ivec3& min, const glm::ivec3& max, std::vector<data_t>& values) {
+            const int nbChannels = finer->nbChannels;
+            for(int z = min.z; z < max.z; ++z) {
+                for(int y = min.y; y < max.y; ++y) {
+                    for(int x = min.x; x < max.x; ++x) {
+                        for(int c = 0; c < nbChannels; ++c) {
+                            auto at = [finer, c](int i, int j, int k) { return finer->at(i, j, k, c); };
+                            values.push_back(getCoarserLevelValue<data_t>(at, x, y, z, size, average));
+                        }
+                    }
+                }
+            }
+        };
+        // A voxel of the level is background if the 2x2x2 voxels it replaces are
+        EmptyTest isEmpty;
+        if(this->isEmpty) {
+            EmptyTest finerIsEmpty = this->isEmpty;
+            isEmpty = [finerIsEmpty](const glm::ivec3& min, const glm::ivec3& max) { return finerIsEmpty(min * 2, max * 2); };
+        }
+        return new PagedCache<data_t>(glm::vec3((size + 1) / 2), this->nbChannels, this->capacity / 8, loader, isEmpty);
+    }
+
+    uint16_t getValue(const glm::vec3& coord, Interpolation::Method interpolationMethod) override {
+        if(coord[0]<0 || coord[1]<0 || coord[2]<0 || coord[0]>=this->size[0] || coord[1]>=this->size[1] || coord[2]>=this->size[2]) return static_cast<uint16_t>(0);
+        auto at = [this](int x, int y, int z) { return static_cast<float>(this->at(x, y, z)); };
+        return Interpolation::interpolate<data_t>(at, coord, interpolationMethod);
+    }
+
+private:
+    struct Slot {
+        //! @brief nullptr if the brick is not in memory, only accessed with std::atomic_load() and std::atomic_store() .
+        Brick brick;
+        std::atomic<uint64_t> lastUse{0};
+    };
+
+    glm::vec3 size;
+    int nbChannels;
+    std::size_t capacity;
+    Loader loader;
+    EmptyTest isEmpty;
+    Brick emptyBrick;
+    glm::ivec3 nbBricks;
+    std::unique_ptr<Slot[]> slots;
+
+    //! @brief Protects resident and residentSize.
+    mutable std::mutex mutex;
+    //! @brief Indices of the bricks in memory.
+    mutable std::vector<std::size_t> resident;
+    mutable std::size_t residentSize;
+    //! @brief Incremented each time a thread starts to read a brick, gives the lastUse of the bricks.
+    mutable std::atomic<uint64_t> clock;
+    //! @brief Unique identifier of the cache, to recognize the last brick used by a thread.
+    const uint64_t id;
+
+    static uint64_t getNextId() {
+        static std::atomic<uint64_t> nextId(1);
+        return nextId.fetch_add(1);
+    }
+
+    std::size_t getBrickMemory() const {
+        return static_cast<std::size_t>(PAGED_CACHE_BRICK_SIZE) * PAGED_CACHE_BRICK_SIZE * PAGED_CACHE_BRICK_SIZE * this->nbChannels * sizeof(data_t);
+    }
+
+    const std::vector<data_t>& getBrick(std::size_t brickIdx) const {
+        // The last brick used by the thread, which also keeps it alive
+        thread_local uint64_t lastCacheId = 0;
+        thread_local std::size_t lastBrickIdx = 0;
+        thread_local Brick lastBrick;
+        if(lastCacheId != this->id || lastBrickIdx != brickIdx || !lastBrick) {
+            Slot& slot = this->slots[brickIdx];
+            slot.lastUse.store(this->clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+            Brick brick = std::atomic_load(&slot.brick);
+            lastBrick = brick ? brick : this->loadBrick(brickIdx);
+            lastCacheId = this->id;
+            lastBrickIdx = brickIdx;
+        }
+        return *lastBrick;
+    }
 
-    std::vector<int> indices;
-    std::vector<std::vector<uint16_t>> data;
+    Brick loadBrick(std::size_t brickIdx) const {
+        const int brickSize = PAGED_CACHE_BRICK_SIZE;
+        const glm::ivec3 brickCoord(brickIdx % this->nbBricks.x, (brickIdx / this->nbBricks.x) % this->nbBricks.y, brickIdx / (static_cast<std::size_t>(this->nbBricks.x) * this->nbBricks.y));
+        const glm::ivec3 min = brickCoord * brickSize;
+        const glm::ivec3 max = glm::min(min + brickSize, glm::ivec3(this->size));
+        if(this->isEmpty && this->isEmpty(min, max)) {
+            // Shared by all the empty bricks, it is kept in their slots as it uses no more memory
+            std::atomic_store(&this->slots[brickIdx].brick, this->emptyBrick);
+            return this->emptyBrick;
+        }
+        // Read outside of the lock, so that the bricks are loaded in parallel
+        std::vector<data_t> values;
+        values.reserve(static_cast<std::size_t>(max.x - min.x) * (max.y - min.y) * (max.z - min.z) * this->nbChannels);
+        this->loader(min, max, values);
 
-    UnsortedCache(glm::vec3 imageSize, int capacity);
+        std::shared_ptr<std::vector<data_t>> brick = std::make_shared<std::vector<data_t>>(this->getBrickMemory() / sizeof(data_t), 0);
+        std::size_t i = 0;
+        for(int z = 0; z < max.z - min.z; ++z) {
+            for(int y = 0; y < max.y - min.y; ++y) {
+                for(int x = 0; x < max.x - min.x && i + this->nbChannels <= values.size(); ++x) {
+                    for(int c = 0; c < this->nbChannels; ++c)
+                        (*brick)[((static_cast<std::size_t>(c) * brickSize + z) * brickSize + y) * brickSize + x] = values[i++];
+                }
+            }
+        }
 
-    std::vector<uint16_t> * storeImage(int imageIdx);
-    uint16_t getValue(const glm::vec3& coord);
+        std::lock_guard<std::mutex> lock(this->mutex);
+        Slot& slot = this->slots[brickIdx];
+        // Another thread may have loaded the brick meanwhile
+        Brick current = std::atomic_load(&slot.brick);
+        if(current)
+            return current;
+        std::atomic_store(&slot.brick, Brick(brick));
+        this->resident.push_back(brickIdx);
+        this->residentSize += this->getBrickMemory();
+        if(this->residentSize > this->capacity)
+            this->dropLeastRecentlyUsed();
+        return brick;
+    }
 
-    bool isCached(int imageIdx) const;
-    int getCachedIdx(int imageIdx) const;
-    int getNextCachedImageToReplace() const;
+    //! @brief Called with mutex locked.
+    void dropLeastRecentlyUsed() const {
+        // lastUse is updated by the other threads, so it is read once before sorting
+        std::vector<std::pair<uint64_t, std::size_t>> bricks;
+        bricks.reserve(this->resident.size());
+        for(std::size_t brickIdx : this->resident)
+            bricks.emplace_back(this->slots[brickIdx].lastUse.load(std::memory_order_relaxed), brickIdx);
+        std::sort(bricks.begin(), bricks.end());
+        std::size_t nbDropped = 0;
+        // The most recent brick is always kept, even if it is larger than the capacity
+        while(this->residentSize > this->capacity / 4 * 3 && nbDropped + 1 < bricks.size()) {
+            std::atomic_store(&this->slots[bricks[nbDropped].second].brick, Brick());
+            this->residentSize -= this->getBrickMemory();
+            ++nbDropped;
+        }
+        this->resident.clear();
+        for(std::size_t i = nbDropped; i < bricks.size(); ++i)
+            this->resident.push_back(bricks[i].second);
+    }
 
-    void setCapacity(int capacity);
+    template <typename out_data_t>
+    void copySlice(int imageIdx, std::vector<out_data_t>& data) const {
+        const int width = this->size[0];
+        const int height = this->size[1];
+        const std::size_t insertIdx = data.size();
+        data.resize(insertIdx + static_cast<std::size_t>(width) * height * this->nbChannels);
+        out_data_t * slice = data.data() + insertIdx;
+        for(int y = 0; y < height; ++y) {
+            for(int x = 0; x < width; ++x) {
+                for(int c = 0; c < this->nbChannels; ++c)
+                    *slice++ = this->at(x, y, imageIdx, c);
+            }
+        }
+    }
 };
 
 //! @}
@@ -4,11 +4,90 @@
 #include <glm/gtx/io.hpp>
 #include <algorithm>
 #include <limits.h>
+#include <cstring>
+#include <sstream>
+#include <map>
+#include <omp.h>
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-TIFFReader::TIFFReader(const std::vector<std::string>& filename): tiffReader(new TIFFReaderLibtiff(filename)) {
+void adviseFileRange(int fd, const uint8_t * mapping, uint64_t offset, uint64_t size, SliceAdvice advice) {
+#if defined(__unix__) && defined(POSIX_FADV_DONTNEED)
+    if(fd < 0 || size == 0)
+        return;
+    if(advice == SliceAdvice::WillNeed) {
+        // Asynchronous: the kernel reads the range in the background
+        posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+        return;
+    }
+    // Only the pages entirely inside the range are dropped, the other ones may belong to the neighbouring slices
+    const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    if(mapping) {
+        // The pages mapped by the process are kept in the page cache, they must be unmapped first
+        const uintptr_t begin = (reinterpret_cast<uintptr_t>(mapping) + pageSize - 1) / pageSize * pageSize;
+        const uintptr_t end = (reinterpret_cast<uintptr_t>(mapping) + size) / pageSize * pageSize;
+        if(begin < end)
+            madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+    }
+    const uint64_t begin = (offset + pageSize - 1) / pageSize * pageSize;
+    const uint64_t end = (offset + size) / pageSize * pageSize;
+    if(begin < end)
+        posix_fadvise(fd, begin, end - begin, POSIX_FADV_DONTNEED);
+#endif
+}
+
+/***/
+
+TIFFReader::TIFFReader(const std::vector<std::string>& filename, const ImageIndex * index): rowCache(std::make_shared<DecodedRowCache>(DECODED_ROW_CACHE_SIZE)), rowsPerCachedBlock(0), scanlineSize(0) {
+    if(index && index->isLoaded()) {
+        this->tiffReader = new TIFFReaderLibtiff(filename, std::vector<toff_t>(index->directoryOffsets.begin(), index->directoryOffsets.end()));
+        this->imgResolution = index->imgResolution;
+        this->imgDataType = index->imgDataType;
+        this->voxelSize = index->voxelSize;
+        this->nbChannels = this->tiffReader->getNbChannels();
+        return;
+    }
+    this->tiffReader = new TIFFReaderLibtiff(filename);
     this->imgResolution = this->tiffReader->getImageResolution();
     this->imgDataType = this->tiffReader->getImageInternalDataType(); 
     this->voxelSize = this->tiffReader->getVoxelSize();
+    this->nbChannels = this->tiffReader->getNbChannels();
+}
+
+TIFFReader::TIFFReader(const TIFFReader& other): voxelSize(other.voxelSize), imgResolution(other.imgResolution), imgDataType(other.imgDataType), nbChannels(other.nbChannels), tiffReader(new TIFFReaderLibtiff(*other.tiffReader)), mappedReader(other.mappedReader), rowCache(other.rowCache), rowsPerCachedBlock(other.rowsPerCachedBlock.load()), scanlineSize(other.scanlineSize.load()) {}
+
+bool TIFFReader::enableMemoryMapping(ImageIndex * index) {
+    std::shared_ptr<TIFFReaderMapped> mapped = std::make_shared<TIFFReaderMapped>(this->tiffReader->filenames, index);
+    const bool canBeMapped = mapped->isValid() && static_cast<int>(mapped->sliceFile.size()) == static_cast<int>(this->imgResolution[2]);
+    // The layout is only known if all the files have been mapped, it is stored even if it does not allow the mapping, to not check it again
+    if(index && index->isEnabled() && !index->hasStripLayout() && mapped->mappings.size() == this->tiffReader->filenames.size()) {
+        std::vector<std::vector<uint64_t>> sliceStripOffsets;
+        if(canBeMapped) {
+            for(const std::vector<uint64>& offsets : mapped->sliceStripOffsets)
+                sliceStripOffsets.emplace_back(offsets.begin(), offsets.end());
+            index->setStripLayout(mapped->scanlineSize, mapped->rowsPerStrip, mapped->sliceFile, sliceStripOffsets);
+        } else {
+            index->setStripLayout(0, 0, {}, sliceStripOffsets);
+        }
+    }
+    if(!canBeMapped) {
+        std::cout << "Memory mapping not available, the image is read with libtiff" << std::endl;
+        return false;
+    }
+    std::cout << "Memory mapping enabled" << std::endl;
+    this->mappedReader = mapped;
+    return true;
+}
+
+void TIFFReader::adviseSlice(int sliceIdx, SliceAdvice advice) const {
+    if(this->mappedReader)
+        this->mappedReader->adviseSlice(sliceIdx, advice);
+    else
+        this->tiffReader->adviseImage(sliceIdx, advice);
 }
 
 Image::ImageDataType TIFFReader::getInternalDataType() const {
@@ -54,91 +133,377 @@ uint16_t TIFFReader::getValue(const glm::vec3& coord) const {
     // If we read directly from the raw image we use Nearest Neighbor interpolation
     const glm::vec3 newCoord{std::floor(coord[0]), std::floor(coord[1]), std::floor(coord[2])};
     int imageIdx = newCoord[2];
-    this->tiffReader->setImageToRead(imageIdx);
-    tdata_t buf = _TIFFmalloc(this->tiffReader->getScanLineSize());
-    this->tiffReader->readScanline(buf, newCoord[1]);
-    uint16_t res = getToLowPrecision(this->getInternalDataType(), buf, newCoord[0]);
-    _TIFFfree(buf);
-    return res;
+    DecodedRowCache::Block block;
+    tdata_t row = const_cast<uint8_t*>(this->getRow(imageIdx, newCoord[1], block));
+    return getToLowPrecision(this->getInternalDataType(), row, newCoord[0] * this->nbChannels);
 }
 
-//Function to cast and insert for the get slice
-// Important: a cast do not change a value, so if we want to cast from an int we need to make a conversion, this is the usage of needInversion
-template <typename data_t>
-void castToUintAndInsert(data_t * values, std::vector<uint16_t>& res, int duplicate, int offset, std::pair<glm::vec3, glm::vec3> bboxes, bool needInversion = false) {
-    for(int i = bboxes.first[0]; i < bboxes.second[0]; i+=offset) {
-        for(int j = 0; j < duplicate; ++j)
-            if(needInversion)
-                res.push_back(static_cast<uint16_t>((std::bitset<sizeof(data_t) * CHAR_BIT>(values[i]).flip(std::bitset<sizeof(data_t)*CHAR_BIT>().size()-1)).to_ulong())); 
-            else
-                res.push_back(static_cast<uint16_t>(values[i])); 
+const uint8_t * TIFFReader::getRow(int sliceIdx, uint32 row, DecodedRowCache::Block& block) const {
+    if(this->mappedReader)
+        return this->mappedReader->getRow(sliceIdx, row);
+
+    uint32 rowsPerBlock = this->rowsPerCachedBlock.load(std::memory_order_acquire);
+    if(rowsPerBlock > 0) {
+        const uint32 firstRow = row - row % rowsPerBlock;
+        block = this->rowCache->get(sliceIdx, firstRow);
+        if(block)
+            return block->data() + (row - firstRow) * this->scanlineSize.load(std::memory_order_relaxed);
     }
+
+    // The libtiff handle is shared by all the threads calling getValue()
+    std::lock_guard<std::mutex> lock(this->decodeMutex);
+    this->tiffReader->setImageToRead(sliceIdx);
+    if(rowsPerBlock == 0) {
+        // Blocks are strips or rows of tiles, unless they are too large compared to the cache
+        const tsize_t size = this->tiffReader->getScanLineSize();
+        const uint32 maxRows = std::max<std::size_t>(1, DECODED_ROW_CACHE_SIZE / (16 * size));
+        rowsPerBlock = std::min(this->tiffReader->getRowsPerBlock(), maxRows);
+        this->scanlineSize.store(size, std::memory_order_relaxed);
+        this->rowsPerCachedBlock.store(rowsPerBlock, std::memory_order_release);
+    }
+    const tsize_t size = this->scanlineSize.load(std::memory_order_relaxed);
+    const uint32 firstRow = row - row % rowsPerBlock;
+    // Another thread may have decoded the block while we were waiting
+    block = this->rowCache->get(sliceIdx, firstRow);
+    if(!block) {
+        const uint32 lastRow = std::min(firstRow + rowsPerBlock, static_cast<uint32>(this->imgResolution[1]));
+        std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>((lastRow - firstRow) * size);
+        block = data;
+        if(this->tiffReader->readRows(data->data(), firstRow, lastRow)) {
+            this->rowCache->insert(sliceIdx, firstRow, block);
+        } else {
+            // Not cached, so that the next reads of these rows try to decode them again
+            std::cout << "WARNING: cannot decode the rows [" << firstRow << ", " << lastRow << "[ of the slice [" << sliceIdx << "], they are read as zeros" << std::endl;
+            std::fill(data->begin(), data->end(), 0);
+        }
+    }
+    return block->data() + (row - firstRow) * size;
 }
 
-//Function to cast and insert for the get slice
-void castToLowPrecision(Image::ImageDataType imgDataType, const tdata_t& buf, std::vector<uint16_t>& res, int duplicate, int offset, std::pair<glm::vec3, glm::vec3> bboxes) {
-    if(imgDataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_8)) {
-        uint8_t * data = static_cast<std::uint8_t*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes);
-    } else if(imgDataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_16)) {
-        uint16_t * data = static_cast<uint16_t*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes);
-    } else if(imgDataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_32)) {
-        uint32_t * data = static_cast<std::uint32_t*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes);
-    } else if(imgDataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_64)) {
-        uint64_t * data = static_cast<std::uint64_t*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes);
-    } else if(imgDataType == (Image::ImageDataType::Signed | Image::ImageDataType::Bit_8)) {
-        int8_t * data = static_cast<std::int8_t*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes, true);
-    } else if(imgDataType == (Image::ImageDataType::Signed | Image::ImageDataType::Bit_16)) {
-        int16_t * data = static_cast<std::int16_t*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes, true);
-    } else if(imgDataType == (Image::ImageDataType::Signed | Image::ImageDataType::Bit_32)) {
-        int32_t * data = static_cast<std::int32_t*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes, true);
-    } else if(imgDataType == (Image::ImageDataType::Signed | Image::ImageDataType::Bit_64)) {
-        int64_t * data = static_cast<std::int64_t*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes, true);
-    } else if(imgDataType == (Image::ImageDataType::Floating | Image::ImageDataType::Bit_32)) {
-        float * data = static_cast<float*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes);
-    } else if(imgDataType == (Image::ImageDataType::Floating | Image::ImageDataType::Bit_64)) {
-        double * data = static_cast<double*>(buf);
-        castToUintAndInsert(data, res, duplicate, offset, bboxes);
-    } 
+template <typename out_data_t>
+void TIFFReader::getSlice(int sliceIdx, std::vector<out_data_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes, SubsampleMethod subsampleMethod) const {
+    readSliceByRows(*this, sliceIdx, result, nbChannel, offsets, bboxes, subsampleMethod);
 }
 
-void TIFFReader::getSlice(int sliceIdx, std::vector<std::uint16_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes) const {
-    this->tiffReader->setImageToRead(sliceIdx);
+template void TIFFReader::getSlice<std::uint8_t>(int sliceIdx, std::vector<std::uint8_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes, SubsampleMethod subsampleMethod) const;
+template void TIFFReader::getSlice<std::uint16_t>(int sliceIdx, std::vector<std::uint16_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes, SubsampleMethod subsampleMethod) const;
+
+/***/
 
-    tdata_t buf;
-    buf = _TIFFmalloc(this->tiffReader->getScanLineSize());
+DecodedRowCache::DecodedRowCache(std::size_t capacity): capacity(capacity), size(0) {}
+
+uint64_t DecodedRowCache::getKey(int sliceIdx, uint32 firstRow) {
+    return (static_cast<uint64_t>(sliceIdx) << 32) | firstRow;
+}
+
+DecodedRowCache::Block DecodedRowCache::get(int sliceIdx, uint32 firstRow) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->blocksPerKey.find(getKey(sliceIdx, firstRow));
+    if(it == this->blocksPerKey.end())
+        return nullptr;
+    this->blocks.splice(this->blocks.begin(), this->blocks, it->second);
+    return it->second->second;
+}
 
-    uint32 row;
-    for (row = bboxes.first[1]; row < bboxes.second[1]; row+=offsets.second) {
-        this->tiffReader->readScanline(buf, row);
-        castToLowPrecision(this->getInternalDataType(), buf, result, nbChannel, offsets.first, bboxes);
+void DecodedRowCache::insert(int sliceIdx, uint32 firstRow, const Block& block) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const uint64_t key = getKey(sliceIdx, firstRow);
+    if(this->blocksPerKey.count(key) > 0)
+        return;
+    this->blocks.emplace_front(key, block);
+    this->blocksPerKey[key] = this->blocks.begin();
+    this->size += block->size();
+    this->dropLeastRecentlyUsed();
+}
+
+void DecodedRowCache::setCapacity(std::size_t capacity) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->capacity = capacity;
+    this->dropLeastRecentlyUsed();
+}
+
+void DecodedRowCache::dropLeastRecentlyUsed() {
+    // The most recent block is always kept, even if it is larger than the capacity
+    while(this->size > this->capacity && this->blocks.size() > 1) {
+        this->size -= this->blocks.back().second->size();
+        this->blocksPerKey.erase(this->blocks.back().first);
+        this->blocks.pop_back();
     }
-    _TIFFfree(buf);
 }
 
 /***/
 
-TIFFReaderLibtiff::TIFFReaderLibtiff(const std::vector<std::string>& filename): filenames(filename) {
+TIFFReaderMapped::TIFFReaderMapped(const std::vector<std::string>& filenames, const ImageIndex * index): filenames(filenames), scanlineSize(0), rowsPerStrip(0), valid(false) {
+    for(int fileIdx = 0; fileIdx < filenames.size(); ++fileIdx) {
+        const uint8_t * mapping = this->mapFile(fileIdx);
+        if(!mapping)
+            return;
+        this->mappings.push_back(mapping);
+    }
+
+    if(index && index->hasStripLayout()) {
+        this->valid = this->setSlices(*index);
+        return;
+    }
+
+    for(int fileIdx = 0; fileIdx < filenames.size(); ++fileIdx) {
+        TIFF * tif = TIFFHandlePool::getInstance().acquire(filenames[fileIdx]);
+        if(!tif)
+            return;
+        bool layoutIsValid = true;
+        // As in TIFFReaderLibtiff, a multi-file stack contains one slice per file
+        do {
+            layoutIsValid = this->addSlice(tif, fileIdx, this->mappingSizes[fileIdx]);
+        } while(layoutIsValid && filenames.size() == 1 && TIFFReadDirectory(tif));
+        TIFFHandlePool::getInstance().release(filenames[fileIdx], tif);
+        if(!layoutIsValid)
+            return;
+    }
+    this->valid = !this->sliceFile.empty();
+}
+
+TIFFReaderMapped::~TIFFReaderMapped() {
+#ifdef __unix__
+    for(int fileIdx = 0; fileIdx < this->mappings.size(); ++fileIdx)
+        munmap(const_cast<uint8_t*>(this->mappings[fileIdx]), this->mappingSizes[fileIdx]);
+#else
+    // Closing the QFile also unmaps it
+    for(QFile * file : this->files)
+        delete file;
+#endif
+}
+
+const uint8_t * TIFFReaderMapped::mapFile(int fileIdx) {
+#ifdef __unix__
+    // The file descriptor is closed right away, the mapping stays valid: stacks with more files than the limit of open files can be mapped
+    const int fd = open(this->filenames[fileIdx].c_str(), O_RDONLY);
+    if(fd < 0)
+        return nullptr;
+    struct stat fileInfo;
+    void * mapping = MAP_FAILED;
+    if(fstat(fd, &fileInfo) == 0 && fileInfo.st_size > 0)
+        mapping = mmap(nullptr, fileInfo.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return nullptr;
+    this->mappingSizes.push_back(fileInfo.st_size);
+    return static_cast<const uint8_t*>(mapping);
+#else
+    QFile * file = new QFile(QString(this->filenames[fileIdx].c_str()));
+    this->files.push_back(file);
+    if(!file->open(QIODevice::ReadOnly))
+        return nullptr;
+    const uint8_t * mapping = file->map(0, file->size());
+    if(mapping)
+        this->mappingSizes.push_back(file->size());
+    return mapping;
+#endif
+}
+
+bool TIFFReaderMapped::isValid() const {
+    return this->valid;
+}
+
+void TIFFReaderMapped::adviseSlice(int sliceIdx, SliceAdvice advice) const {
+    const int fileIdx = this->sliceFile[sliceIdx];
+    const std::vector<uint64>& offsets = this->sliceStripOffsets[sliceIdx];
+    // The strips of a slice are usually contiguous
+    const uint64 begin = *std::min_element(offsets.begin(), offsets.end());
+    const uint64 end = *std::max_element(offsets.begin(), offsets.end()) + this->rowsPerStrip * this->scanlineSize;
+    const uint64 fileSize = this->mappingSizes[fileIdx];
+#ifdef __unix__
+    // The file is only opened for the time of the advice, as the mapping does not keep it open
+    const int fd = open(this->filenames[fileIdx].c_str(), O_RDONLY);
+    adviseFileRange(fd, this->mappings[fileIdx] + begin, begin, std::min(end, fileSize) - begin, advice);
+    if(fd >= 0)
+        close(fd);
+#else
+    adviseFileRange(this->files[fileIdx]->handle(), this->mappings[fileIdx] + begin, begin, std::min(end, fileSize) - begin, advice);
+#endif
+}
+
+bool TIFFReaderMapped::setSlices(const ImageIndex& index) {
+    if(index.rowsPerStrip == 0 || index.sliceFile.empty())
+        return false;
+    this->scanlineSize = index.scanlineSize;
+    this->rowsPerStrip = index.rowsPerStrip;
+    for(std::size_t slice = 0; slice < index.sliceFile.size(); ++slice) {
+        const int fileIdx = index.sliceFile[slice];
+        const std::vector<uint64_t>& offsets = index.sliceStripOffsets[slice];
+        if(fileIdx < 0 || fileIdx >= this->mappings.size() || offsets.empty())
+            return false;
+        const uint64 length = index.imgResolution[1];
+        for(std::size_t strip = 0; strip < offsets.size(); ++strip) {
+            const uint64 stripRows = std::min<uint64>(this->rowsPerStrip, length - strip * this->rowsPerStrip);
+            if(strip * this->rowsPerStrip >= length || offsets[strip] + stripRows * this->scanlineSize > this->mappingSizes[fileIdx])
+                return false;
+        }
+        this->sliceFile.push_back(fileIdx);
+        this->sliceStripOffsets.emplace_back(offsets.begin(), offsets.end());
+    }
+    return true;
+}
+
+bool TIFFReaderMapped::addSlice(TIFF * tif, int fileIdx, uint64 fileSize) {
+    uint16_t compression = 0;
+    uint16_t planarConfig = 0;
+    uint16_t samplesPerPixel = 0;
+    uint32 rowsPerStrip = 0;
+    uint32 length = 0;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planarConfig);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &length);
+    if(compression != COMPRESSION_NONE || TIFFIsTiled(tif) || TIFFIsByteSwapped(tif))
+        return false;
+    if(planarConfig != PLANARCONFIG_CONTIG && samplesPerPixel > 1)
+        return false;
+    rowsPerStrip = std::max(1u, std::min(rowsPerStrip, length));
+
+    // All slices must share the same layout to be addressed with getRow()
+    const tsize_t scanlineSize = TIFFScanlineSize(tif);
+    if(this->sliceFile.empty()) {
+        this->scanlineSize = scanlineSize;
+        this->rowsPerStrip = rowsPerStrip;
+    } else if(this->scanlineSize != scanlineSize || this->rowsPerStrip != rowsPerStrip) {
+        return false;
+    }
+
+    uint64 * stripOffsets = nullptr;
+    if(TIFFGetField(tif, TIFFTAG_STRIPOFFSETS, &stripOffsets) != 1 || !stripOffsets)
+        return false;
+    const tstrip_t nbStrips = TIFFNumberOfStrips(tif);
+    std::vector<uint64> offsets(stripOffsets, stripOffsets + nbStrips);
+    for(tstrip_t strip = 0; strip < nbStrips; ++strip) {
+        const uint64 stripRows = std::min(rowsPerStrip, length - strip * rowsPerStrip);
+        if(offsets[strip] + stripRows * scanlineSize > fileSize)
+            return false;
+    }
+
+    this->sliceFile.push_back(fileIdx);
+    this->sliceStripOffsets.push_back(offsets);
+    return true;
+}
+
+/***/
+
+TIFFReaderLibtiff::TIFFReaderLibtiff(const std::vector<std::string>& filename, const std::vector<toff_t>& directoryOffsets): filenames(filename), directoryOffsets(directoryOffsets), imageRanges(std::make_shared<ImageRanges>()) {
     TIFFSetWarningHandler(nullptr); // Prevent to display warning
-    this->tif = TIFFOpen(this->filenames[0].c_str(), "r");
+    this->tifFilename = this->filenames[0];
+    this->tif = TIFFHandlePool::getInstance().acquire(this->tifFilename);
+    this->openedImage = 0;
+    if(this->filenames.size() == 1 && this->directoryOffsets.empty())
+        this->buildDirectoryIndex();
+}
+
+TIFFReaderLibtiff::TIFFReaderLibtiff(const TIFFReaderLibtiff& other): filenames(other.filenames), directoryOffsets(other.directoryOffsets), imageRanges(other.imageRanges) {
+    this->tifFilename = this->filenames[0];
+    this->tif = TIFFHandlePool::getInstance().acquire(this->tifFilename);
+    this->openedImage = 0;
+}
+
+TIFFReaderLibtiff::~TIFFReaderLibtiff() {
+    this->closeImage();
+}
+
+void TIFFReaderLibtiff::buildDirectoryIndex() {
+    this->directoryOffsets.clear();
+    do {
+        this->directoryOffsets.push_back(TIFFCurrentDirOffset(this->tif));
+    } while (TIFFReadDirectory(this->tif));
+    TIFFSetSubDirectory(this->tif, this->directoryOffsets[0]);
     this->openedImage = 0;
 }
 
 void TIFFReaderLibtiff::openImage(int imageIdx) {
-    TIFFClose(this->tif);
-    this->tif = TIFFOpen(this->filenames[imageIdx].c_str(), "r");
+    this->closeImage();
+    this->tifFilename = this->filenames[imageIdx];
+    this->tif = TIFFHandlePool::getInstance().acquire(this->tifFilename);
+    this->openedImage = imageIdx;
 }
 
 void TIFFReaderLibtiff::closeImage() {
-    TIFFClose(this->tif);
+    if(this->tif)
+        TIFFHandlePool::getInstance().release(this->tifFilename, this->tif);
+    this->tif = nullptr;
+}
+
+/***/
+
+TIFFHandlePool& TIFFHandlePool::getInstance() {
+    static TIFFHandlePool pool(128);
+    return pool;
+}
+
+TIFFHandlePool::TIFFHandlePool(int capacity): capacity(capacity) {}
+
+TIFFHandlePool::~TIFFHandlePool() {
+    for(Handle& handle : this->idleHandles)
+        TIFFClose(handle.tif);
+}
+
+TIFF * TIFFHandlePool::acquire(const std::string& filename) {
+    Handle handle{filename, nullptr, 0};
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->idleHandlesPerFile.find(filename);
+        if(it != this->idleHandlesPerFile.end()) {
+            handle = *it->second;
+            this->idleHandles.erase(it->second);
+            this->idleHandlesPerFile.erase(it);
+            this->firstDirectories[handle.tif] = handle.firstDirectory;
+        }
+    }
+    if(handle.tif) {
+        // The previous user may have left the handle on another directory
+        if(TIFFCurrentDirOffset(handle.tif) != handle.firstDirectory)
+            TIFFSetSubDirectory(handle.tif, handle.firstDirectory);
+        return handle.tif;
+    }
+
+    // Opening the file is done outside the lock so that other threads are not blocked.
+    // libtiff do not map the file, so that the pages read can be dropped from the page cache, see adviseFileRange()
+    TIFF * tif = TIFFOpen(filename.c_str(), "rm");
+    if(tif) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->firstDirectories[tif] = TIFFCurrentDirOffset(tif);
+    }
+    return tif;
+}
+
+void TIFFHandlePool::release(const std::string& filename, TIFF * tif) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto lent = this->firstDirectories.find(tif);
+    if(lent == this->firstDirectories.end()) {
+        TIFFClose(tif);
+        return;
+    }
+    this->idleHandles.push_front(Handle{filename, tif, lent->second});
+    this->idleHandlesPerFile.emplace(filename, this->idleHandles.begin());
+    this->firstDirectories.erase(lent);
+    while(static_cast<int>(this->idleHandles.size()) > this->capacity)
+        this->closeLeastRecentlyUsed();
+}
+
+void TIFFHandlePool::setCapacity(int capacity) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->capacity = capacity;
+    while(static_cast<int>(this->idleHandles.size()) > this->capacity)
+        this->closeLeastRecentlyUsed();
+}
+
+void TIFFHandlePool::closeLeastRecentlyUsed() {
+    const Handle& handle = this->idleHandles.back();
+    auto range = this->idleHandlesPerFile.equal_range(handle.filename);
+    for(auto it = range.first; it != range.second; ++it) {
+        if(it->second->tif == handle.tif) {
+            this->idleHandlesPerFile.erase(it);
+            break;
+        }
+    }
+    TIFFClose(handle.tif);
+    this->idleHandles.pop_back();
 }
 
 glm::vec3 TIFFReaderLibtiff::getImageResolution() const {
@@ -149,9 +514,7 @@ glm::vec3 TIFFReaderLibtiff::getImageResolution() const {
     TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
     int dircount = 0;
     if(this->filenames.size() == 1) {
-        do {
-            dircount++;
-        } while (TIFFReadDirectory(tif));
+        dircount = this->directoryOffsets.size();
     } else {
         dircount = this->filenames.size(); 
     }
@@ -182,6 +545,21 @@ glm::vec3 TIFFReaderLibtiff::getVoxelSize() const {
     return voxelSize;
 }
 
+int TIFFReaderLibtiff::getNbChannels() const {
+    uint16_t samplesPerPixel = 1;
+    uint16_t planarConfig = PLANARCONFIG_CONTIG;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planarConfig);
+    if(samplesPerPixel > 1 && planarConfig != PLANARCONFIG_CONTIG) {
+        // The strips of the first plane are read as a single channel image
+        std::cout << "WARNING: the channels of the image are stored in separate planes, only the first one is read" << std::endl;
+        return 1;
+    }
+    if(samplesPerPixel > 1)
+        std::cout << "Channels: " << samplesPerPixel << std::endl;
+    return std::max<int>(1, samplesPerPixel);
+}
+
 Image::ImageDataType TIFFReaderLibtiff::getImageInternalDataType() const {
     uint16_t sf = SAMPLEFORMAT_VOID;
     int result	= TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &sf);
@@ -270,10 +648,14 @@ Image::ImageDataType TIFFReaderLibtiff::getImageInternalDataType() const {
 }
 
 void TIFFReaderLibtiff::setImageToRead(int sliceIdx) {
+    if(sliceIdx == this->openedImage)
+        return;
     if(this->filenames.size() > 1) {
         this->openImage(sliceIdx);
     } else {
-        TIFFSetDirectory(this->tif, sliceIdx);
+        // Unlike TIFFSetDirectory, TIFFSetSubDirectory directly reads the directory at the given offset
+        TIFFSetSubDirectory(this->tif, this->directoryOffsets[sliceIdx]);
+        this->openedImage = sliceIdx;
     }
 }
 
@@ -284,3 +666,678 @@ tsize_t TIFFReaderLibtiff::getScanLineSize() const {
 int TIFFReaderLibtiff::readScanline(tdata_t buf, uint32 row) const {
     return TIFFReadScanline(this->tif, buf, row);
 }
+
+uint32 TIFFReaderLibtiff::getRowsPerBlock() const {
+    uint32 length = 0;
+    TIFFGetField(this->tif, TIFFTAG_IMAGELENGTH, &length);
+    uint32 rowsPerBlock = length;
+    if(TIFFIsTiled(this->tif)) {
+        TIFFGetField(this->tif, TIFFTAG_TILELENGTH, &rowsPerBlock);
+    } else {
+        // When the tag is missing libtiff defaults it to 2^32-1, i.e. the whole image is a single strip
+        TIFFGetFieldDefaulted(this->tif, TIFFTAG_ROWSPERSTRIP, &rowsPerBlock);
+    }
+    return std::max(1u, std::min(rowsPerBlock, length));
+}
+
+void TIFFReaderLibtiff::adviseImage(int imageIdx, SliceAdvice advice) const {
+    const bool singleFile = this->filenames.size() == 1;
+    if(singleFile && imageIdx >= static_cast<int>(this->directoryOffsets.size()))
+        return;
+    const std::string& filename = this->filenames[singleFile ? 0 : imageIdx];
+    {
+        std::lock_guard<std::mutex> lock(this->imageRanges->mutex);
+        auto range = this->imageRanges->ranges.find(imageIdx);
+        if(range != this->imageRanges->ranges.end()) {
+            // Advising a range does not move the file offset, but the handle tif may be on another file
+#ifdef __unix__
+            const int fd = open(filename.c_str(), O_RDONLY);
+            adviseFileRange(fd, nullptr, range->second.first, range->second.second - range->second.first, advice);
+            if(fd >= 0)
+                close(fd);
+#endif
+            return;
+        }
+    }
+    // Another handle is used to keep the current directory of tif
+    TIFF * tif = TIFFHandlePool::getInstance().acquire(filename);
+    if(!tif)
+        return;
+    uint64 begin = 0;
+    uint64 end = 0;
+    if(!singleFile || TIFFSetSubDirectory(tif, this->directoryOffsets[imageIdx])) {
+        const bool tiled = TIFFIsTiled(tif);
+        const uint32 nbBlocks = tiled ? TIFFNumberOfTiles(tif) : TIFFNumberOfStrips(tif);
+        uint64 * offsets = nullptr;
+        uint64 * byteCounts = nullptr;
+        if(TIFFGetField(tif, tiled ? TIFFTAG_TILEOFFSETS : TIFFTAG_STRIPOFFSETS, &offsets) == 1 && TIFFGetField(tif, tiled ? TIFFTAG_TILEBYTECOUNTS : TIFFTAG_STRIPBYTECOUNTS, &byteCounts) == 1 && nbBlocks > 0) {
+            begin = std::numeric_limits<uint64>::max();
+            for(uint32 i = 0; i < nbBlocks; ++i) {
+                begin = std::min(begin, offsets[i]);
+                end = std::max(end, offsets[i] + byteCounts[i]);
+            }
+            adviseFileRange(TIFFFileno(tif), nullptr, begin, end - begin, advice);
+        }
+    }
+    TIFFHandlePool::getInstance().release(filename, tif);
+    // An empty range is also kept, so that the directory of an unreadable image is not read again
+    std::lock_guard<std::mutex> lock(this->imageRanges->mutex);
+    this->imageRanges->ranges[imageIdx] = {begin, std::max(begin, end)};
+}
+
+bool TIFFReaderLibtiff::isCompressed() const {
+    uint16_t compression = COMPRESSION_NONE;
+    TIFFGetFieldDefaulted(this->tif, TIFFTAG_COMPRESSION, &compression);
+    return compression != COMPRESSION_NONE;
+}
+
+bool TIFFReaderLibtiff::readRows(tdata_t buf, uint32 rowBegin, uint32 rowEnd) const {
+    const tsize_t scanlineSize = this->getScanLineSize();
+    const uint32 rowsPerBlock = this->getRowsPerBlock();
+    uint8_t * out = static_cast<uint8_t*>(buf);
+
+    uint32 width = 0;
+    uint32 length = 0;
+    TIFFGetField(this->tif, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(this->tif, TIFFTAG_IMAGELENGTH, &length);
+
+    const bool tiled = TIFFIsTiled(this->tif);
+    uint32 tileWidth = width;
+    if(tiled)
+        TIFFGetField(this->tif, TIFFTAG_TILEWIDTH, &tileWidth);
+    const tsize_t pixelSize = scanlineSize / width;
+    const uint32 firstBlockRow = (rowBegin / rowsPerBlock) * rowsPerBlock;
+    const int nbBlockRows = (rowEnd - firstBlockRow + rowsPerBlock - 1) / rowsPerBlock;
+    const int nbBlockColumns = (width + tileWidth - 1) / tileWidth;
+    const int nbBlocks = nbBlockRows * nbBlockColumns;
+
+    // Decode the strip or the tile blockIdx with the handle tif, each block is copied to a distinct part of buf
+    auto decodeBlock = [&](TIFF * tif, int blockIdx, std::vector<uint8_t>& block) {
+        const uint32 y = firstBlockRow + (blockIdx / nbBlockColumns) * rowsPerBlock;
+        const uint32 firstRow = std::max(y, rowBegin);
+        if(tiled) {
+            const uint32 x = (blockIdx % nbBlockColumns) * tileWidth;
+            const uint32 lastRow = std::min(y + rowsPerBlock, rowEnd);
+            const tsize_t tileRowSize = tileWidth * pixelSize;
+            block.resize(TIFFTileSize(tif));
+            if(TIFFReadEncodedTile(tif, TIFFComputeTile(tif, x, y, 0, 0), block.data(), block.size()) < 0)
+                return false;
+            // Tiles on the right border are padded, only the part inside the image is copied
+            const tsize_t copySize = std::min(tileWidth, width - x) * pixelSize;
+            for(uint32 row = firstRow; row < lastRow; ++row)
+                std::memcpy(out + (row - rowBegin) * scanlineSize + x * pixelSize, block.data() + (row - y) * tileRowSize, copySize);
+            return true;
+        }
+        const uint32 stripEnd = std::min(y + rowsPerBlock, length);
+        const uint32 lastRow = std::min(stripEnd, rowEnd);
+        const tstrip_t stripIdx = TIFFComputeStrip(tif, y, 0);
+        if(firstRow == y && lastRow == stripEnd) {
+            // The whole strip is requested: decode it in place
+            return TIFFReadEncodedStrip(tif, stripIdx, out + (y - rowBegin) * scanlineSize, (stripEnd - y) * scanlineSize) >= 0;
+        }
+        block.resize((stripEnd - y) * scanlineSize);
+        if(TIFFReadEncodedStrip(tif, stripIdx, block.data(), block.size()) < 0)
+            return false;
+        std::memcpy(out + (firstRow - rowBegin) * scanlineSize, block.data() + (firstRow - y) * scanlineSize, (lastRow - firstRow) * scanlineSize);
+        return true;
+    };
+
+    // The blocks are independent, so compressed blocks are decoded by several threads.
+    // This is skipped when the caller already reads several slices in parallel, e.g. Sampler::fillCache().
+    if(nbBlocks > 1 && this->isCompressed() && !omp_in_parallel()) {
+        const toff_t directory = TIFFCurrentDirOffset(this->tif);
+        bool success = true;
+        #pragma omp parallel
+        {
+            // A libtiff handle cannot be shared between threads, the other threads borrow handles on the same file from TIFFHandlePool
+            TIFF * threadTif = (omp_get_thread_num() == 0) ? this->tif : TIFFHandlePool::getInstance().acquire(this->tifFilename);
+            // A handle which cannot be moved to the slice would decode the blocks of another slice
+            bool ready = threadTif != nullptr;
+            if(threadTif && threadTif != this->tif && !TIFFSetSubDirectory(threadTif, directory))
+                ready = false;
+            std::vector<uint8_t> block;
+            #pragma omp for schedule(dynamic)
+            for(int blockIdx = 0; blockIdx < nbBlocks; ++blockIdx) {
+                if(!ready || !decodeBlock(threadTif, blockIdx, block)) {
+                    #pragma omp atomic write
+                    success = false;
+                }
+            }
+            if(threadTif && threadTif != this->tif)
+                TIFFHandlePool::getInstance().release(this->tifFilename, threadTif);
+        }
+        return success;
+    }
+
+    std::vector<uint8_t> block;
+    for(int blockIdx = 0; blockIdx < nbBlocks; ++blockIdx) {
+        if(!decodeBlock(this->tif, blockIdx, block))
+            return false;
+    }
+    return true;
+}
+
+/***/
+
+// Reverse the bytes of each voxel, to read data written with another byte order
+static void swapVoxelBytes(uint8_t * data, std::size_t size, int bytesPerVoxel) {
+    for(std::size_t i = 0; i + bytesPerVoxel <= size; i += bytesPerVoxel)
+        std::reverse(data + i, data + i + bytesPerVoxel);
+}
+
+DIMReader::DIMReader(const std::vector<std::string>& filename): voxelSize(1., 1., 1.), imgResolution(0., 0., 0.), imgDataType(Image::ImageDataType::Unknown), bytesPerVoxel(0), data(nullptr) {
+    const std::string baseName = filename[0].substr(0, filename[0].find_last_of("."));
+    const std::string imaFilename = baseName + ".ima";
+
+    bool bigEndian = false;
+    if(!this->readHeader(baseName + ".dim", bigEndian)) {
+        this->imgResolution = glm::vec3(0., 0., 0.);
+        return;
+    }
+
+    const std::size_t dataSize = static_cast<std::size_t>(this->imgResolution[0]) * this->imgResolution[1] * this->imgResolution[2] * this->bytesPerVoxel;
+    this->imaFile = std::make_shared<QFile>(QString(imaFilename.c_str()));
+    if(!this->imaFile->open(QIODevice::ReadOnly) || static_cast<std::size_t>(this->imaFile->size()) < dataSize) {
+        std::cout << "WARNING: the file [" << imaFilename << "] cannot be opened or is smaller than described in its header." << std::endl;
+        this->imgResolution = glm::vec3(0., 0., 0.);
+        return;
+    }
+
+    const uint16_t one = 1;
+    const bool hostIsBigEndian = *reinterpret_cast<const uint8_t*>(&one) == 0;
+    const bool needSwap = this->bytesPerVoxel > 1 && bigEndian != hostIsBigEndian;
+    if(!needSwap) {
+        const uint8_t * mapping = this->imaFile->map(0, dataSize);
+        if(mapping) {
+            this->data = mapping;
+            return;
+        }
+        std::cout << "WARNING: memory mapping not available, the image is loaded in memory" << std::endl;
+    }
+
+    // The data cannot be used as is from the file
+    this->ownedData = std::make_shared<std::vector<uint8_t>>(dataSize);
+    this->imaFile->read(reinterpret_cast<char*>(this->ownedData->data()), dataSize);
+    if(needSwap)
+        swapVoxelBytes(this->ownedData->data(), dataSize, this->bytesPerVoxel);
+    this->data = this->ownedData->data();
+}
+
+bool DIMReader::readHeader(const std::string& dimFilename, bool& bigEndian) {
+    std::ifstream dimFile(dimFilename);
+    if(!dimFile.is_open()) {
+        std::cout << "WARNING: cannot open the file [" << dimFilename << "]" << std::endl;
+        return false;
+    }
+
+    // First line: nx ny nz [nt]
+    std::string line;
+    std::getline(dimFile, line);
+    std::istringstream dimensions(line);
+    int n[4] = {1, 1, 1, 1};
+    for(int i = 0; i < 4 && (dimensions >> n[i]); ++i) {}
+    if(n[3] > 1)
+        std::cout << "WARNING: the image contains [" << n[3] << "] volumes, only the first one is read" << std::endl;
+
+    std::string tag, type, byteOrder;
+    while(dimFile >> tag) {
+        if(tag == "-type")
+            dimFile >> type;
+        else if(tag == "-dx")
+            dimFile >> this->voxelSize[0];
+        else if(tag == "-dy")
+            dimFile >> this->voxelSize[1];
+        else if(tag == "-dz")
+            dimFile >> this->voxelSize[2];
+        else if(tag == "-bo")
+            dimFile >> byteOrder;
+    }
+
+    const std::map<std::string, std::pair<Image::ImageDataType, int>> types{
+        {"U8", {Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_8, 1}},
+        {"S8", {Image::ImageDataType::Signed | Image::ImageDataType::Bit_8, 1}},
+        {"U16", {Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_16, 2}},
+        {"S16", {Image::ImageDataType::Signed | Image::ImageDataType::Bit_16, 2}},
+        {"U32", {Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_32, 4}},
+        {"S32", {Image::ImageDataType::Signed | Image::ImageDataType::Bit_32, 4}},
+        {"FLOAT", {Image::ImageDataType::Floating | Image::ImageDataType::Bit_32, 4}},
+        {"DOUBLE", {Image::ImageDataType::Floating | Image::ImageDataType::Bit_64, 8}}
+    };
+    auto it = types.find(type);
+    if(it == types.end()) {
+        std::cout << "WARNING: unsupported data type [" << type << "] in [" << dimFilename << "]" << std::endl;
+        return false;
+    }
+    this->imgDataType = it->second.first;
+    this->bytesPerVoxel = it->second.second;
+    this->imgResolution = glm::vec3(n[0], n[1], n[2]);
+    // The byte order is written as the bytes of the integer "ABCD" in the memory of the writer
+    bigEndian = (byteOrder == "ABCD");
+
+    std::cout << "(nx,dx) = ( " << n[0] << " ; " << this->voxelSize[0] << " ) "<< std::endl;
+    std::cout << "(ny,dy) = ( " << n[1] << " ; " << this->voxelSize[1] << " ) "<< std::endl;
+    std::cout << "(nz,dz) = ( " << n[2] << " ; " << this->voxelSize[2] << " ) "<< std::endl;
+    return true;
+}
+
+bool DIMReader::isValid() const {
+    return this->data != nullptr;
+}
+
+void DIMReader::adviseSlice(int sliceIdx, SliceAdvice advice) const {
+    if(this->ownedData || !this->data)
+        return;
+    const std::size_t sliceSize = static_cast<std::size_t>(this->imgResolution[0]) * this->imgResolution[1] * this->bytesPerVoxel;
+    adviseFileRange(this->imaFile->handle(), this->data + sliceIdx * sliceSize, sliceIdx * sliceSize, sliceSize, advice);
+}
+
+uint16_t DIMReader::getValue(const glm::vec3& coord) const {
+    const glm::ivec3 newCoord{std::floor(coord[0]), std::floor(coord[1]), std::floor(coord[2])};
+    tdata_t row = const_cast<uint8_t*>(this->getRow(newCoord[2], newCoord[1]));
+    return getToLowPrecision(this->getInternalDataType(), row, newCoord[0]);
+}
+
+/***/
+
+// Size of the window of deflate, i.e. the maximum distance of the back references
+static constexpr std::size_t GZIP_WINDOW_SIZE = 1 << 15;
+
+GzipSliceStream::GzipSliceStream(const std::string& filename, std::size_t dataOffset, std::size_t sliceSize, int bytesPerVoxel, bool swapBytes): file(filename, std::ios::in | std::ios::binary), streamReady(false), raw(false), input(1 << 20), compressedOffset(0), offset(0), history(GZIP_WINDOW_SIZE, 0), dataOffset(dataOffset), sliceSize(sliceSize), bytesPerVoxel(bytesPerVoxel), swapBytes(swapBytes), nextSlice(0), decodedSlices(std::max<std::size_t>(DECODED_ROW_CACHE_SIZE, sliceSize)) {
+    if(!this->file.is_open()) {
+        std::cout << "WARNING: cannot open the file [" << filename << "]" << std::endl;
+        return;
+    }
+    std::memset(&this->stream, 0, sizeof(this->stream));
+    // 15 + 32: maximum window size, with automatic detection of the gzip or zlib header
+    this->streamReady = inflateInit2(&this->stream, 15 + 32) == Z_OK;
+    if(!this->streamReady) {
+        std::cout << "WARNING: cannot initialise the decompression of the file [" << filename << "]" << std::endl;
+        return;
+    }
+    this->rewind();
+}
+
+GzipSliceStream::~GzipSliceStream() {
+    if(this->streamReady)
+        inflateEnd(&this->stream);
+}
+
+bool GzipSliceStream::isValid() const {
+    return this->streamReady;
+}
+
+bool GzipSliceStream::rewind() {
+    this->nextSlice = 0;
+    this->file.clear();
+    this->file.seekg(0);
+    this->compressedOffset = 0;
+    this->offset = 0;
+    this->stream.avail_in = 0;
+    this->raw = false;
+    if(inflateReset2(&this->stream, 15 + 32) != Z_OK)
+        return false;
+    return this->inflateData(nullptr, this->dataOffset) == this->dataOffset;
+}
+
+bool GzipSliceStream::seekSlice(int sliceIdx) {
+    const uint64_t target = this->dataOffset + static_cast<uint64_t>(sliceIdx) * this->sliceSize;
+    auto next = std::upper_bound(this->checkpoints.begin(), this->checkpoints.end(), target, [](uint64_t value, const Checkpoint& checkpoint) {
+        return value < checkpoint.offset;
+    });
+    if(next == this->checkpoints.begin()) {
+        if(!this->rewind())
+            return false;
+    } else if(!this->restart(*(next - 1))) {
+        return false;
+    }
+    this->nextSlice = sliceIdx;
+    const uint64_t skippedSize = target - this->offset;
+    return this->inflateData(nullptr, skippedSize) == skippedSize;
+}
+
+bool GzipSliceStream::restart(const Checkpoint& checkpoint) {
+    this->file.clear();
+    this->file.seekg(checkpoint.compressedOffset - (checkpoint.bits ? 1 : 0));
+    this->compressedOffset = checkpoint.compressedOffset - (checkpoint.bits ? 1 : 0);
+    this->stream.avail_in = 0;
+    if(inflateReset2(&this->stream, -15) != Z_OK)
+        return false;
+    this->raw = true;
+    if(checkpoint.bits) {
+        if(!this->fillInput())
+            return false;
+        const int previousByte = this->stream.next_in[0];
+        this->stream.next_in += 1;
+        this->stream.avail_in -= 1;
+        if(inflatePrime(&this->stream, checkpoint.bits, previousByte >> (8 - checkpoint.bits)) != Z_OK)
+            return false;
+    }
+    if(inflateSetDictionary(&this->stream, checkpoint.window.data(), checkpoint.window.size()) != Z_OK)
+        return false;
+    this->offset = checkpoint.offset - checkpoint.window.size();
+    this->addToHistory(checkpoint.window.data(), checkpoint.window.size());
+    this->offset = checkpoint.offset;
+    return true;
+}
+
+bool GzipSliceStream::fillInput() {
+    if(this->stream.avail_in > 0)
+        return true;
+    this->file.read(reinterpret_cast<char*>(this->input.data()), this->input.size());
+    const std::streamsize nbRead = this->file.gcount();
+    if(nbRead <= 0)
+        return false;
+    this->stream.next_in = this->input.data();
+    this->stream.avail_in = nbRead;
+    this->compressedOffset += nbRead;
+    return true;
+}
+
+bool GzipSliceStream::nextMember() {
+    if(this->raw) {
+        // The gzip trailer (CRC and size) is not read by a raw stream
+        for(int i = 0; i < 8; ++i) {
+            if(!this->fillInput())
+                return false;
+            this->stream.next_in += 1;
+            this->stream.avail_in -= 1;
+        }
+        this->raw = false;
+        if(inflateReset2(&this->stream, 15 + 32) != Z_OK)
+            return false;
+    } else if(inflateReset(&this->stream) != Z_OK) {
+        return false;
+    }
+    // A gzip file can be made of several concatenated members
+    return this->fillInput();
+}
+
+void GzipSliceStream::addToHistory(const uint8_t * data, std::size_t size) {
+    uint64_t start = this->offset;
+    if(size > GZIP_WINDOW_SIZE) {
+        start += size - GZIP_WINDOW_SIZE;
+        data += size - GZIP_WINDOW_SIZE;
+        size = GZIP_WINDOW_SIZE;
+    }
+    const std::size_t position = start % GZIP_WINDOW_SIZE;
+    const std::size_t firstPart = std::min(size, GZIP_WINDOW_SIZE - position);
+    std::memcpy(this->history.data() + position, data, firstPart);
+    std::memcpy(this->history.data(), data + firstPart, size - firstPart);
+}
+
+void GzipSliceStream::addCheckpoint() {
+    Checkpoint checkpoint;
+    checkpoint.compressedOffset = this->compressedOffset - this->stream.avail_in;
+    checkpoint.bits = this->stream.data_type & 7;
+    checkpoint.offset = this->offset;
+    const std::size_t position = this->offset % GZIP_WINDOW_SIZE;
+    checkpoint.window.reserve(GZIP_WINDOW_SIZE);
+    checkpoint.window.insert(checkpoint.window.end(), this->history.begin() + position, this->history.end());
+    checkpoint.window.insert(checkpoint.window.end(), this->history.begin(), this->history.begin() + position);
+    this->checkpoints.push_back(std::move(checkpoint));
+}
+
+std::size_t GzipSliceStream::inflateData(uint8_t * data, std::size_t size) {
+    std::vector<uint8_t> skipped(data ? 0 : std::min<std::size_t>(size, 1 << 20));
+    std::size_t produced = 0;
+    while(produced < size) {
+        if(!this->fillInput())
+            break;
+        uint8_t * output = data ? data + produced : skipped.data();
+        const std::size_t chunkSize = std::min<std::size_t>(size - produced, data ? (1 << 30) : skipped.size());
+        this->stream.next_out = output;
+        this->stream.avail_out = chunkSize;
+        // Z_BLOCK stops at the end of each deflate block, where a checkpoint can be saved
+        const int status = inflate(&this->stream, Z_BLOCK);
+        const std::size_t nbOut = chunkSize - this->stream.avail_out;
+        this->addToHistory(output, nbOut);
+        this->offset += nbOut;
+        produced += nbOut;
+        if(status == Z_STREAM_END) {
+            if(!this->nextMember())
+                break;
+        } else if(status != Z_OK && status != Z_BUF_ERROR) {
+            break;
+        } else if((this->stream.data_type & 128) && !(this->stream.data_type & 64)) {
+            // End of a deflate block which is not the last one of the member
+            const uint64_t lastCheckpoint = this->checkpoints.empty() ? 0 : this->checkpoints.back().offset;
+            if(this->offset >= lastCheckpoint + GZIP_CHECKPOINT_SPACING)
+                this->addCheckpoint();
+        }
+    }
+    return produced;
+}
+
+DecodedRowCache::Block GzipSliceStream::getSlice(int sliceIdx) {
+    DecodedRowCache::Block slice = this->decodedSlices.get(sliceIdx, 0);
+    if(slice)
+        return slice;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    // Another thread may have decompressed the slice while we were waiting
+    slice = this->decodedSlices.get(sliceIdx, 0);
+    if(slice)
+        return slice;
+    if(sliceIdx < this->nextSlice && !this->seekSlice(sliceIdx))
+        std::cout << "WARNING: cannot rewind the compressed image" << std::endl;
+
+    // The slices skipped to reach sliceIdx are kept, as other threads are likely to request them
+    while(this->nextSlice <= sliceIdx) {
+        std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>(this->sliceSize, 0);
+        const std::size_t readSize = this->inflateData(data->data(), this->sliceSize);
+        if(readSize < this->sliceSize)
+            std::cout << "WARNING: the compressed image is truncated at slice [" << this->nextSlice << "]" << std::endl;
+        if(this->swapBytes)
+            swapVoxelBytes(data->data(), this->sliceSize, this->bytesPerVoxel);
+        this->decodedSlices.insert(this->nextSlice, 0, data);
+        if(this->nextSlice == sliceIdx)
+            slice = data;
+        this->nextSlice += 1;
+    }
+    return slice;
+}
+
+/***/
+
+NIFTIReader::NIFTIReader(const std::vector<std::string>& filename): voxelSize(1., 1., 1.), imgResolution(0., 0., 0.), imgDataType(Image::ImageDataType::Unknown), bytesPerVoxel(0), rowSize(0), sliceSize(0), dataOffset(0), data(nullptr) {
+    std::size_t dataOffset = 0;
+    bool swapBytes = false;
+    if(!this->readHeader(filename[0], dataOffset, swapBytes)) {
+        this->imgResolution = glm::vec3(0., 0., 0.);
+        return;
+    }
+    this->dataOffset = dataOffset;
+    this->rowSize = static_cast<std::size_t>(this->imgResolution[0]) * this->bytesPerVoxel;
+    this->sliceSize = this->rowSize * static_cast<std::size_t>(this->imgResolution[1]);
+    const std::size_t dataSize = this->sliceSize * static_cast<std::size_t>(this->imgResolution[2]);
+
+    const std::string gzipExtension = ".gz";
+    if(filename[0].size() > gzipExtension.size() && filename[0].compare(filename[0].size() - gzipExtension.size(), gzipExtension.size(), gzipExtension) == 0) {
+        this->gzipStream = std::make_shared<GzipSliceStream>(filename[0], dataOffset, this->sliceSize, this->bytesPerVoxel, swapBytes);
+        if(!this->gzipStream->isValid())
+            this->imgResolution = glm::vec3(0., 0., 0.);
+        return;
+    }
+
+    this->file = std::make_shared<QFile>(QString(filename[0].c_str()));
+    if(!this->file->open(QIODevice::ReadOnly) || static_cast<std::size_t>(this->file->size()) < dataOffset + dataSize) {
+        std::cout << "WARNING: the file [" << filename[0] << "] cannot be opened or is smaller than described in its header." << std::endl;
+        this->imgResolution = glm::vec3(0., 0., 0.);
+        return;
+    }
+    if(!swapBytes) {
+        const uint8_t * mapping = this->file->map(dataOffset, dataSize);
+        if(mapping) {
+            this->data = mapping;
+            return;
+        }
+        std::cout << "WARNING: memory mapping not available, the image is loaded in memory" << std::endl;
+    }
+
+    // The data cannot be used as is from the file
+    this->ownedData = std::make_shared<std::vector<uint8_t>>(dataSize);
+    this->file->seek(dataOffset);
+    this->file->read(reinterpret_cast<char*>(this->ownedData->data()), dataSize);
+    if(swapBytes)
+        swapVoxelBytes(this->ownedData->data(), dataSize, this->bytesPerVoxel);
+    this->data = this->ownedData->data();
+}
+
+bool NIFTIReader::readHeader(const std::string& filename, std::size_t& dataOffset, bool& swapBytes) {
+    // zlib also reads uncompressed files
+    gzFile headerFile = gzopen(filename.c_str(), "rb");
+    if(!headerFile) {
+        std::cout << "WARNING: cannot open the file [" << filename << "]" << std::endl;
+        return false;
+    }
+    // Fixed size header of the NIfTI-1 format
+    const int headerSize = 348;
+    char header[headerSize];
+    const int nbRead = gzread(headerFile, header, headerSize);
+    gzclose(headerFile);
+    if(nbRead != headerSize) {
+        std::cout << "WARNING: [" << filename << "] is too small to be a NIfTI-1 file" << std::endl;
+        return false;
+    }
+
+    swapBytes = false;
+    auto readField = [&](int offset, auto& value) {
+        std::memcpy(&value, header + offset, sizeof(value));
+        if(swapBytes)
+            std::reverse(reinterpret_cast<uint8_t*>(&value), reinterpret_cast<uint8_t*>(&value) + sizeof(value));
+    };
+
+    // The header size field gives the byte order of the file
+    int32_t sizeofHeader = 0;
+    readField(0, sizeofHeader);
+    if(sizeofHeader != headerSize) {
+        swapBytes = true;
+        readField(0, sizeofHeader);
+    }
+    if(sizeofHeader != headerSize) {
+        std::cout << "WARNING: [" << filename << "] is not a NIfTI-1 file" << std::endl;
+        return false;
+    }
+    if(std::strncmp(header + 344, "n+1", 3) != 0) {
+        std::cout << "WARNING: [" << filename << "] is not a single file NIfTI-1 image, header/image pairs are not supported" << std::endl;
+        return false;
+    }
+
+    int16_t dim[8];
+    float pixdim[8];
+    for(int i = 0; i < 8; ++i) {
+        readField(40 + 2 * i, dim[i]);
+        readField(76 + 4 * i, pixdim[i]);
+    }
+    int16_t datatype = 0;
+    readField(70, datatype);
+    float voxOffset = 0.;
+    readField(108, voxOffset);
+
+    const int nbDimensions = dim[0];
+    for(int i = 0; i < 3; ++i) {
+        this->imgResolution[i] = (i + 1 <= nbDimensions) ? std::max<int16_t>(dim[i + 1], 1) : 1;
+        this->voxelSize[i] = (i + 1 <= nbDimensions && pixdim[i + 1] > 0.) ? pixdim[i + 1] : 1.;
+    }
+    if(nbDimensions > 3 && dim[4] > 1)
+        std::cout << "WARNING: the image contains [" << dim[4] << "] volumes, only the first one is read" << std::endl;
+
+    const std::map<int, std::pair<Image::ImageDataType, int>> types{
+        {2, {Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_8, 1}},
+        {256, {Image::ImageDataType::Signed | Image::ImageDataType::Bit_8, 1}},
+        {512, {Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_16, 2}},
+        {4, {Image::ImageDataType::Signed | Image::ImageDataType::Bit_16, 2}},
+        {768, {Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_32, 4}},
+        {8, {Image::ImageDataType::Signed | Image::ImageDataType::Bit_32, 4}},
+        {1280, {Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_64, 8}},
+        {1024, {Image::ImageDataType::Signed | Image::ImageDataType::Bit_64, 8}},
+        {16, {Image::ImageDataType::Floating | Image::ImageDataType::Bit_32, 4}},
+        {64, {Image::ImageDataType::Floating | Image::ImageDataType::Bit_64, 8}}
+    };
+    auto it = types.find(datatype);
+    if(it == types.end()) {
+        std::cout << "WARNING: unsupported NIfTI data type [" << datatype << "] in [" << filename << "]" << std::endl;
+        return false;
+    }
+    this->imgDataType = it->second.first;
+    this->bytesPerVoxel = it->second.second;
+    dataOffset = std::max<std::size_t>(352, static_cast<std::size_t>(voxOffset));
+
+    std::cout << "NIfTI image: " << this->imgResolution << " voxels of size " << this->voxelSize << ", " << this->imgDataType << std::endl;
+    return true;
+}
+
+bool NIFTIReader::isValid() const {
+    return this->data != nullptr || (this->gzipStream && this->gzipStream->isValid());
+}
+
+void NIFTIReader::adviseSlice(int sliceIdx, SliceAdvice advice) const {
+    if(this->ownedData || !this->data)
+        return;
+    adviseFileRange(this->file->handle(), this->data + sliceIdx * this->sliceSize, this->dataOffset + sliceIdx * this->sliceSize, this->sliceSize, advice);
+}
+
+const uint8_t * NIFTIReader::getSliceData(int sliceIdx, DecodedRowCache::Block& slice) const {
+    if(this->gzipStream) {
+        slice = this->gzipStream->getSlice(sliceIdx);
+        return slice->data();
+    }
+    return this->data + sliceIdx * this->sliceSize;
+}
+
+uint16_t NIFTIReader::getValue(const glm::vec3& coord) const {
+    const glm::ivec3 newCoord{std::floor(coord[0]), std::floor(coord[1]), std::floor(coord[2])};
+    DecodedRowCache::Block slice;
+    tdata_t row = const_cast<uint8_t*>(this->getRow(newCoord[2], newCoord[1], slice));
+    return getToLowPrecision(this->getInternalDataType(), row, newCoord[0]);
+}
+
+/***/
+
+BrickedReader::BrickedReader(const std::vector<std::string>& filename): voxelSize(1., 1., 1.), imgResolution(0., 0., 0.), imgDataType(Image::ImageDataType::Unknown), data(nullptr) {
+    this->file = std::make_shared<QFile>(QString(filename[0].c_str()));
+    if(!this->file->open(QIODevice::ReadOnly)) {
+        std::cout << "WARNING: cannot open the file [" << filename[0] << "]" << std::endl;
+        return;
+    }
+    const std::size_t fileSize = this->file->size();
+    this->data = this->file->map(0, fileSize);
+    if(!this->data) {
+        std::cout << "WARNING: memory mapping not available, the image is loaded in memory" << std::endl;
+        this->ownedData = std::make_shared<std::vector<uint8_t>>(fileSize);
+        this->file->read(reinterpret_cast<char*>(this->ownedData->data()), fileSize);
+        this->data = this->ownedData->data();
+    }
+
+    std::shared_ptr<std::vector<BrickTile>> tiles = std::make_shared<std::vector<BrickTile>>();
+    if(!this->header.readPrefix(this->data, fileSize) || !this->header.readMetadata(this->data, fileSize, this->statistics, *tiles)) {
+        std::cout << "WARNING: [" << filename[0] << "] is not a valid bricked image" << std::endl;
+        this->data = nullptr;
+        return;
+    }
+    this->tiles = tiles;
+    this->imgResolution = this->header.imgResolution;
+    this->voxelSize = this->header.voxelSize;
+    this->imgDataType = Image::ImageDataType::Unsigned | ((this->header.bitDepth == 8) ? Image::ImageDataType::Bit_8 : Image::ImageDataType::Bit_16);
+    std::cout << "Bricked image: " << this->imgResolution << " voxels of size " << this->voxelSize << ", " << this->imgDataType << ", bricks of " << this->header.brickSize << " voxels" << std::endl;
+}
+
+bool BrickedReader::isValid() const {
+    return this->data != nullptr && this->tiles;
+}
+
+uint16_t BrickedReader::getValue(const glm::vec3& coord) const {
+    return this->getValue<uint16_t>(coord);
+}
+
+bool BrickedReader::isTileEmpty(int sliceIdx, int brickX, int brickY) const {
+    const BrickTile& tile = (*this->tiles)[this->header.getTileIdx(sliceIdx, brickX, brickY)];
+    if(tile.codec != TileCodec::DeltaRLE || tile.size > 4)
+        return false;
+    const int brickSize = this->header.brickSize;
+    const int tileWidth = std::min(brickSize, static_cast<int>(this->imgResolution[0]) - brickX * brickSize);
+    const int tileHeight = std::min(brickSize, static_cast<int>(this->imgResolution[1]) - brickY * brickSize);
+    thread_local std::vector<uint16_t> decoded;
+    decoded.resize(static_cast<std::size_t>(tileWidth) * tileHeight);
+    return decodeTile(this->data + tile.offset, tile, decoded.data(), decoded.size()) && std::all_of(decoded.begin(), decoded.end(), [](uint16_t value) { return value == 0; });
+}
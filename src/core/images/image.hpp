@@ -5,9 +5,15 @@
 #include <tinytiffwriter.h>
 #include <tiff.h>
 #include <tiffio.h>
+#include <zlib.h>
 #include "cache.hpp"
+#include "image_index.hpp"
+#include "bricked_image.hpp"
 #include <fstream>
+#include <stdexcept>
 #include <bitset>
+#include <type_traits>
+#include <climits>
 //#include <sys/stat.h>
 //#include <filesystem>
 
@@ -16,16 +22,117 @@
 #include <QFileInfo>
 #include <string>
 #include <QXmlStreamReader>
+#include <QFile>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <omp.h>
 
 //! \defgroup img Image
 //! @brief Modules to read images from multiple formats. 
 //! The main class is ImageReader .
 //! These classes do not implement any writing functions.
-//! The only functions to write images are Scene::writeDeformedImageTemplated() and Scene::writeGreyscaleTIFFImage() .
+//! The only functions to write images are Scene::writeDeformedImageTemplated(), Scene::writeGreyscaleTIFFImage() and writeBrickedImage() .
 //
 //! \addtogroup img
 //! @{
 
+//! @brief Bounded pool of opened libtiff handles, shared by all the TIFF readers.
+//!
+//! Opening a file and parsing its header is the main cost of reading multi-file stacks, especially on networked filesystems.
+//! Instead of closing a file when they switch to another one, readers give its handle back to the pool, and reuse it
+//! the next time they need this file.
+//! A handle is lent to a single reader at a time by acquire() until release() is called, as libtiff handles are not thread-safe.
+//! Released handles are kept opened and the least recently released ones are closed when there are more than the pool capacity.
+struct TIFFHandlePool {
+
+    static TIFFHandlePool& getInstance();
+
+    //! @brief Get a handle on the file positioned on its first directory, reusing a released one if possible.
+    TIFF * acquire(const std::string& filename);
+
+    //! @brief Give back a handle obtained with acquire(). The handle must not be used after this call.
+    void release(const std::string& filename, TIFF * tif);
+
+    void setCapacity(int capacity);
+
+private:
+    struct Handle {
+        std::string filename;
+        TIFF * tif;
+        toff_t firstDirectory;
+    };
+
+    int capacity;
+    std::mutex mutex;
+    //! @brief Released handles, the most recently released first.
+    std::list<Handle> idleHandles;
+    std::unordered_multimap<std::string, std::list<Handle>::iterator> idleHandlesPerFile;
+    //! @brief Offset of the first directory of the handles currently lent.
+    std::unordered_map<TIFF*, toff_t> firstDirectories;
+
+    TIFFHandlePool(int capacity);
+    ~TIFFHandlePool();
+
+    void closeLeastRecentlyUsed();
+};
+
+// Memory used by each image to keep the rows decoded by TIFFReader::getValue()
+#define DECODED_ROW_CACHE_SIZE (128 * 1024 * 1024)
+
+//! @brief Thread-safe LRU cache of decoded blocks of rows, used by the random accesses of TIFFReader::getValue() .
+//!
+//! Reading a single voxel with libtiff requires to decode its whole row, and for compressed files its whole strip.
+//! The rows are decoded by blocks which are kept in memory, so that the following queries in the same area do not
+//! decode anything. The least recently used blocks are dropped when the cache exceeds its capacity.
+//! Blocks are shared pointers: a block dropped from the cache stays valid for the threads still using it.
+struct DecodedRowCache {
+    using Block = std::shared_ptr<const std::vector<uint8_t>>;
+
+    //! @param capacity Size in bytes of the decoded data to keep.
+    DecodedRowCache(std::size_t capacity);
+
+    //! @brief Get the block starting at firstRow of slice sliceIdx, or nullptr if it is not cached.
+    Block get(int sliceIdx, uint32 firstRow);
+
+    void insert(int sliceIdx, uint32 firstRow, const Block& block);
+
+    void setCapacity(std::size_t capacity);
+
+private:
+    std::size_t capacity;
+    std::size_t size;
+    std::mutex mutex;
+    //! @brief Cached blocks, the most recently used first.
+    std::list<std::pair<uint64_t, Block>> blocks;
+    std::unordered_map<uint64_t, std::list<std::pair<uint64_t, Block>>::iterator> blocksPerKey;
+
+    static uint64_t getKey(int sliceIdx, uint32 firstRow);
+    void dropLeastRecentlyUsed();
+};
+
+//! @brief Hint given to the kernel about the data of a slice, see ImageReader::setStreamingIngestion() .
+enum class SliceAdvice {
+    WillNeed,// Read it in the background, ahead of the reader
+    DontNeed// Drop it from the page cache, it will not be read again
+};
+
+//! @brief Give advice to the kernel about the bytes [offset, offset + size[ of the file fd.
+//! @param mapping Address of the byte offset if the file is memory mapped by the process, nullptr otherwise.
+//! \note Does nothing on systems without posix_fadvise().
+void adviseFileRange(int fd, const uint8_t * mapping, uint64_t offset, uint64_t size, SliceAdvice advice);
+
+// Uncompressed bytes between two restart points of a GzipSliceStream, each of them keeps 32K of data
+#define GZIP_CHECKPOINT_SPACING (32 * 1024 * 1024)
+
+// Number of slices read ahead by the kernel in the streaming mode of ImageReader
+#define STREAMING_READ_AHEAD 4
+
+// Number of compressed strips or tiles decoded per thread by each call to TIFFReaderLibtiff::readRows() in TIFFReader::readRowsByBlock()
+#define TIFF_BLOCKS_PER_THREAD 2
+
 //! @brief A set of functions to simplify the libtiff API.
 //!
 //! When reading a tiff image with the libtiff there is no notion of pixel, slice or datatype, it just read from
@@ -34,33 +141,128 @@
 struct TIFFReaderLibtiff {
 
     TIFF* tif;
+    //! @brief File of the handle tif, which is borrowed from TIFFHandlePool .
+    std::string tifFilename;
     int openedImage;
     std::vector<std::string> filenames;
+    //! @brief Offset of every directory of a single-file stack, to seek any slice without walking the directory chain.
+    std::vector<toff_t> directoryOffsets;
+
+    //! @brief Byte range [first, second[ of the strips or tiles of the images already advised, shared between the copies of the reader.
+    struct ImageRanges {
+        std::mutex mutex;
+        std::unordered_map<int, std::pair<uint64, uint64>> ranges;
+    };
+    std::shared_ptr<ImageRanges> imageRanges;
+
+    //! @param directoryOffsets If given, used instead of walking the directory chain to build directoryOffsets.
+    TIFFReaderLibtiff(const std::vector<std::string>& filename, const std::vector<toff_t>& directoryOffsets = {});
+
+    //! @brief Open a new handle on the same files, allowing another thread to read the image concurrently.
+    TIFFReaderLibtiff(const TIFFReaderLibtiff& other);
 
-    TIFFReaderLibtiff(const std::vector<std::string>& filename);
+    ~TIFFReaderLibtiff();
 
     glm::vec3 getImageResolution() const;
     glm::vec3 getVoxelSize() const;
     Image::ImageDataType getImageInternalDataType() const;
+    //! @brief Number of interleaved samples per pixel, 1 if the samples are stored in separate planes.
+    int getNbChannels() const;
 
     //! @brief Get how many values are contained in a single row of the image
     tsize_t getScanLineSize() const;
 
     int readScanline(tdata_t buf, uint32 row) const;
 
+    //! @brief Get how many rows are encoded together in a strip or in a row of tiles.
+    uint32 getRowsPerBlock() const;
+
+    //! @brief Whether the strips or tiles of the current image are compressed.
+    bool isCompressed() const;
+
+    //! @brief Decode the rows [rowBegin, rowEnd[ of the current image into buf as consecutive scanlines.
+    //! Rows are decoded with whole strips or tiles so each encoded block is decoded only once,
+    //! buf must be at least (rowEnd - rowBegin) * getScanLineSize() bytes.
+    //! Compressed blocks are decoded in parallel with handles borrowed from TIFFHandlePool, unless it is called from a parallel region.
+    bool readRows(tdata_t buf, uint32 rowBegin, uint32 rowEnd) const;
+
+    //! @brief Give advice to the kernel about the strips or tiles of an image.
+    //! The byte range of the image is read only the first time, through a handle borrowed from TIFFHandlePool .
+    void adviseImage(int imageIdx, SliceAdvice advice) const;
+
     //! @brief The TIFFReader class can handle multiple tiff images, this function set which image has to be read.
     void openImage(int imageIdx);
 
     //! @brief A single tiff image file can contain an entire stack of images, this function set which image has to be read in the current tiff image.
+    //! In a single-file stack the directory is reached in constant time using directoryOffsets.
     void setImageToRead(int sliceIdx);
 
+    //! @brief Walk the directory chain once to fill directoryOffsets, then go back to the first directory.
+    void buildDirectoryIndex();
+
+    //! @brief Give the handle back to TIFFHandlePool .
     void closeImage();
 };
 
+//! @brief Serve the rows of uncompressed TIFF images straight from a memory mapping of the files.
+//!
+//! The strip offsets of every image are read once with libtiff, then rows are accessed as pointers into the mapped
+//! files: there is no libtiff buffer nor copy, and the page cache is used directly.
+//! Only stripped, uncompressed, interleaved images stored with the native byte order can be mapped,
+//! isValid() tells if all the files met these conditions.
+//! \note The mapping is read-only, a single instance can be shared by all threads.
+struct TIFFReaderMapped {
+
+    std::vector<std::string> filenames;
+    //! @brief Address and size of the mapping of each file, the files are not kept open once mapped.
+    std::vector<const uint8_t*> mappings;
+    std::vector<uint64> mappingSizes;
+#ifndef __unix__
+    std::vector<QFile*> files;
+#endif
+
+    //! @brief File index and offsets of every strip of each slice of the stack.
+    std::vector<int> sliceFile;
+    std::vector<std::vector<uint64>> sliceStripOffsets;
+
+    tsize_t scanlineSize;
+    uint32 rowsPerStrip;
+
+    //! @param index If it has the strip layout of the image, the layout is taken from it instead of walking the TIFF directories.
+    TIFFReaderMapped(const std::vector<std::string>& filenames, const ImageIndex * index = nullptr);
+    ~TIFFReaderMapped();
+
+    bool isValid() const;
+
+    void adviseSlice(int sliceIdx, SliceAdvice advice) const;
+
+    //! @brief Pointer to the first value of the row of a slice, inside the mapped file.
+    const uint8_t * getRow(int sliceIdx, uint32 row) const {
+        return this->mappings[this->sliceFile[sliceIdx]] + this->sliceStripOffsets[sliceIdx][row / this->rowsPerStrip] + (row % this->rowsPerStrip) * this->scanlineSize;
+    }
+
+private:
+    bool valid;
+    //! @brief Map the whole file read-only, return nullptr if it cannot be mapped.
+    const uint8_t * mapFile(int fileIdx);
+    //! @brief Take the strips from the index, after checking that they are inside the mapped files.
+    bool setSlices(const ImageIndex& index);
+    //! @brief Check that the current directory can be mapped and register its strips as a new slice.
+    bool addSlice(TIFF * tif, int fileIdx, uint64 fileSize);
+};
+
 enum class ImageFormat {
     TIFF,
     OME_TIFF,
-    DIM_IMA
+    DIM_IMA,
+    NIFTI,
+    BRICKED
+};
+
+//! @brief How the voxels of a block are reduced to a single value when an image is read at a lower resolution.
+enum class SubsampleMethod {
+    Skip,// Keep the first voxel of each block, required for segmented images as labels cannot be averaged
+    Mean// Box filter: average all the voxels of each block, which avoids aliasing
 };
 
 //! @brief Get a single value from a buffer casted from imgDataType type to DataType type
@@ -144,71 +346,222 @@ DataType getImageToLowPrecision(Image::ImageDataType imgDataType, const tdata_t&
         //return data;
     }
 }
-//
-//Function to cast and insert for the get slice
-// Important: a cast do not change a value, so if we want to cast from an int we need to make a conversion, this is the usage of needInversion
-template <typename data_t, typename out_data_t>
-void castToUintAndInsert2(data_t * values, std::vector<out_data_t>& res, int duplicate, int offset, std::pair<glm::vec3, glm::vec3> bboxes, bool needInversion = false) {
-    for(int i = bboxes.first[0]; i < bboxes.second[0]; i+=offset) {
-        for(int j = 0; j < duplicate; ++j)
-            if(needInversion)
-                res.push_back(static_cast<out_data_t>((std::bitset<sizeof(data_t) * CHAR_BIT>(values[i]).flip(std::bitset<sizeof(data_t)*CHAR_BIT>().size()-1)).to_ulong())); 
-            else
-                res.push_back(static_cast<out_data_t>(values[i])); 
-    }
-}
-
-//Function to cast and insert for the get slice
-template <typename data_t>
-void castToLowPrecision2(Image::ImageDataType imgDataType, const tdata_t& buf, std::vector<data_t>& res, int duplicate, int offset, std::pair<glm::vec3, glm::vec3> bboxes) {
+//! @brief Call function once with an Image::tag of the C++ type matching imgDataType.
+//! Allows to select the conversion kernel once per image instead of once per row or per value.
+template <typename Function>
+void dispatchOnDataType(Image::ImageDataType imgDataType, Function&& function) {
     if(imgDataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_8)) {
-        uint8_t * data = static_cast<uint8_t*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes);
+        function(Image::tag<uint8_t>());
     } else if(imgDataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_16)) {
-        uint16_t * data = static_cast<uint16_t*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes);
+        function(Image::tag<uint16_t>());
     } else if(imgDataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_32)) {
-        uint32_t * data = static_cast<uint32_t*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes);
+        function(Image::tag<uint32_t>());
     } else if(imgDataType == (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_64)) {
-        uint64_t * data = static_cast<uint64_t*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes);
+        function(Image::tag<uint64_t>());
     } else if(imgDataType == (Image::ImageDataType::Signed | Image::ImageDataType::Bit_8)) {
-        int8_t * data = static_cast<int8_t*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes, true);
+        function(Image::tag<int8_t>());
     } else if(imgDataType == (Image::ImageDataType::Signed | Image::ImageDataType::Bit_16)) {
-        int16_t * data = static_cast<int16_t*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes, true);
+        function(Image::tag<int16_t>());
     } else if(imgDataType == (Image::ImageDataType::Signed | Image::ImageDataType::Bit_32)) {
-        int32_t * data = static_cast<int32_t*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes, true);
+        function(Image::tag<int32_t>());
     } else if(imgDataType == (Image::ImageDataType::Signed | Image::ImageDataType::Bit_64)) {
-        int64_t * data = static_cast<int64_t*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes, true);
+        function(Image::tag<int64_t>());
     } else if(imgDataType == (Image::ImageDataType::Floating | Image::ImageDataType::Bit_32)) {
-        float * data = static_cast<float*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes);
+        function(Image::tag<float>());
     } else if(imgDataType == (Image::ImageDataType::Floating | Image::ImageDataType::Bit_64)) {
-        double * data = static_cast<double*>(buf);
-        castToUintAndInsert2(data, res, duplicate, offset, bboxes);
-    } 
+        function(Image::tag<double>());
+    }
+}
+
+//! @brief Convert a value to out_data_t. Signed integers are shifted to the unsigned range by flipping their sign bit.
+template <typename out_data_t, typename data_t>
+inline out_data_t convertValue(data_t value) {
+    if constexpr (std::is_integral<data_t>::value && std::is_signed<data_t>::value) {
+        using unsigned_t = typename std::make_unsigned<data_t>::type;
+        constexpr unsigned_t signBit = unsigned_t(1) << (sizeof(data_t) * CHAR_BIT - 1);
+        return static_cast<out_data_t>(static_cast<unsigned_t>(value) ^ signBit);
+    } else {
+        return static_cast<out_data_t>(value);
+    }
 }
 
+//! @brief Conversion kernel of a row: convert the voxels [bboxes.first[0], bboxes.second[0][ taken every offset voxels,
+//! and append duplicate values per voxel at the end of res.
+//! The output is allocated once per row and the loops are written to be vectorised.
+//! @param nbSamples Number of interleaved channels of the row. The channel l of the output is the channel min(l, nbSamples - 1)
+//! of the row, so a single channel is duplicated, and a row with several channels is read in a single pass.
+template <typename data_t, typename out_data_t>
+void castToUintAndInsert(const data_t * values, std::vector<out_data_t>& res, int duplicate, int offset, std::pair<glm::vec3, glm::vec3> bboxes, int nbSamples = 1) {
+    const int begin = bboxes.first[0];
+    const int end = bboxes.second[0];
+    if(end <= begin)
+        return;
+    const int nbValues = (end - begin + offset - 1) / offset;
+    const std::size_t insertIdx = res.size();
+    res.resize(insertIdx + static_cast<std::size_t>(nbValues) * duplicate);
+    out_data_t * out = res.data() + insertIdx;
+    const data_t * in = values + static_cast<std::size_t>(begin) * nbSamples;
+
+    if(nbSamples > 1) {
+        const int voxelStride = offset * nbSamples;
+        for(int i = 0; i < nbValues; ++i)
+            for(int j = 0; j < duplicate; ++j)
+                out[i * duplicate + j] = convertValue<out_data_t>(in[i * voxelStride + std::min(j, nbSamples - 1)]);
+    } else if(duplicate == 1 && offset == 1) {
+        #pragma omp simd
+        for(int i = 0; i < nbValues; ++i)
+            out[i] = convertValue<out_data_t>(in[i]);
+    } else if(duplicate == 1) {
+        #pragma omp simd
+        for(int i = 0; i < nbValues; ++i)
+            out[i] = convertValue<out_data_t>(in[i * offset]);
+    } else {
+        for(int i = 0; i < nbValues; ++i) {
+            const out_data_t value = convertValue<out_data_t>(in[i * offset]);
+            for(int j = 0; j < duplicate; ++j)
+                out[i * duplicate + j] = value;
+        }
+    }
+}
+
+//! @brief Reduction kernel of a row: add the values [bboxes.first[0], bboxes.second[0][ to sums, where sums[i] accumulates
+//! the offset consecutive values starting at bboxes.first[0] + i * offset.
+//! @param nbSamples Number of interleaved channels of the row, sums[i * nbSamples + c] accumulates the channel c.
+template <typename data_t>
+void accumulateRow(const data_t * values, std::vector<uint64_t>& sums, int offset, std::pair<glm::vec3, glm::vec3> bboxes, int nbSamples = 1) {
+    const int begin = bboxes.first[0];
+    const int end = bboxes.second[0];
+    if(end <= begin)
+        return;
+    const int nbValues = (end - begin + offset - 1) / offset;
+    sums.resize(static_cast<std::size_t>(nbValues) * nbSamples, 0);
+    uint64_t * out = sums.data();
+    const data_t * in = values + static_cast<std::size_t>(begin) * nbSamples;
+
+    if(nbSamples > 1) {
+        for(int x = 0; x < end - begin; ++x)
+            for(int c = 0; c < nbSamples; ++c)
+                out[(x / offset) * nbSamples + c] += convertValue<uint16_t>(in[x * nbSamples + c]);
+        return;
+    }
+
+    // Full blocks, the inner loop is vectorised
+    const int nbFullBlocks = (end - begin) / offset;
+    for(int i = 0; i < nbFullBlocks; ++i) {
+        uint64_t sum = 0;
+        #pragma omp simd reduction(+:sum)
+        for(int j = 0; j < offset; ++j)
+            sum += convertValue<uint16_t>(in[i * offset + j]);
+        out[i] += sum;
+    }
+    // Last block, that may be cut by the bbox
+    for(int x = nbFullBlocks * offset; x < end - begin; ++x)
+        out[nbFullBlocks] += convertValue<uint16_t>(in[x]);
+}
+
+//! @brief Append the means of the blocks accumulated in sums by accumulateRow() over nbRows rows, with duplicate values per voxel,
+//! at the end of res. Channels are mapped like in castToUintAndInsert(). sums is reset to 0 to accumulate the next rows.
+template <typename out_data_t>
+void insertMeans(std::vector<uint64_t>& sums, int nbRows, std::vector<out_data_t>& res, int duplicate, int offset, std::pair<glm::vec3, glm::vec3> bboxes, int nbSamples = 1) {
+    const int begin = bboxes.first[0];
+    const int end = bboxes.second[0];
+    const int nbValues = sums.size() / nbSamples;
+    const std::size_t insertIdx = res.size();
+    res.resize(insertIdx + static_cast<std::size_t>(nbValues) * duplicate);
+    out_data_t * out = res.data() + insertIdx;
+    for(int i = 0; i < nbValues; ++i) {
+        const uint64_t nbVoxels = static_cast<uint64_t>(std::min(offset, end - (begin + i * offset))) * nbRows;
+        for(int j = 0; j < duplicate; ++j) {
+            // Rounded to the nearest integer
+            const uint64_t sum = sums[static_cast<std::size_t>(i) * nbSamples + std::min(j, nbSamples - 1)];
+            out[i * duplicate + j] = static_cast<out_data_t>((sum + nbVoxels / 2) / nbVoxels);
+        }
+    }
+    std::fill(sums.begin(), sums.end(), 0);
+}
+
+//! @brief Convert and append a row of imgDataType values, see castToUintAndInsert().
+//! \note To convert many rows, prefer to call dispatchOnDataType() once and castToUintAndInsert() on each row.
+template <typename out_data_t>
+void castToLowPrecision(Image::ImageDataType imgDataType, const tdata_t& buf, std::vector<out_data_t>& res, int duplicate, int offset, std::pair<glm::vec3, glm::vec3> bboxes) {
+    dispatchOnDataType(imgDataType, [&](auto typeTag) {
+        using data_t = typename decltype(typeTag)::type;
+        castToUintAndInsert(static_cast<const data_t*>(buf), res, duplicate, offset, bboxes);
+    });
+}
+
+//! @brief Implementation of ImageReader::getSlice() for the readers providing getInternalDataType() and
+//! readRowsByBlock(sliceIdx, rowBegin, rowEnd, rowOffset, processRow).
+//! The conversion kernel is selected once for the whole slice, and rows are converted as soon as they are read.
+template <typename reader_t, typename out_data_t>
+void readSliceByRows(const reader_t& reader, int sliceIdx, std::vector<out_data_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes, SubsampleMethod subsampleMethod) {
+    // All the channels of the image are decoded together, whatever the number of channels requested
+    const int nbSamples = reader.getNbChannels();
+    const std::size_t nbRows = (bboxes.second[1] - bboxes.first[1] + offsets.second - 1) / offsets.second;
+    const std::size_t nbColumns = (bboxes.second[0] - bboxes.first[0] + offsets.first - 1) / offsets.first;
+    result.reserve(result.size() + nbRows * nbColumns * nbChannel);
+
+    if(subsampleMethod == SubsampleMethod::Mean && (offsets.first > 1 || offsets.second > 1)) {
+        // Only one row of sums is kept, every block of offsets.second rows is written as soon as it is complete
+        std::vector<uint64_t> sums(nbColumns * nbSamples, 0);
+        int nbAccumulatedRows = 0;
+        dispatchOnDataType(reader.getInternalDataType(), [&](auto typeTag) {
+            using data_t = typename decltype(typeTag)::type;
+            reader.readRowsByBlock(sliceIdx, bboxes.first[1], bboxes.second[1], 1, [&](tdata_t row) {
+                accumulateRow(static_cast<const data_t*>(row), sums, offsets.first, bboxes, nbSamples);
+                if(++nbAccumulatedRows == offsets.second) {
+                    insertMeans(sums, nbAccumulatedRows, result, nbChannel, offsets.first, bboxes, nbSamples);
+                    nbAccumulatedRows = 0;
+                }
+            });
+        });
+        // Last block, that may be cut by the bbox
+        if(nbAccumulatedRows > 0)
+            insertMeans(sums, nbAccumulatedRows, result, nbChannel, offsets.first, bboxes, nbSamples);
+        return;
+    }
+
+    dispatchOnDataType(reader.getInternalDataType(), [&](auto typeTag) {
+        using data_t = typename decltype(typeTag)::type;
+        reader.readRowsByBlock(sliceIdx, bboxes.first[1], bboxes.second[1], offsets.second, [&](tdata_t row) {
+            castToUintAndInsert(static_cast<const data_t*>(row), result, nbChannel, offsets.first, bboxes, nbSamples);
+        });
+    });
+}
 
 struct TIFFReader {
 
     glm::vec3 voxelSize; // Read from the image, not necessarily the one used in the software
     glm::vec3 imgResolution;
     Image::ImageDataType imgDataType;
+    //! @brief Number of channels interleaved in the rows, e.g. 3 for RGB images.
+    int nbChannels;
 
     TIFFReaderLibtiff * tiffReader;
+    //! @brief Set by enableMemoryMapping() when the files can be read without libtiff, shared between the copies of the reader.
+    std::shared_ptr<TIFFReaderMapped> mappedReader;
+    //! @brief Rows decoded by getValue(), shared between the copies of the reader.
+    std::shared_ptr<DecodedRowCache> rowCache;
 
-    TIFFReader(const std::vector<std::string>& filename);
+    //! @param index If loaded, the image informations are taken from it instead of being read from the file.
+    TIFFReader(const std::vector<std::string>& filename, const ImageIndex * index = nullptr);
+
+    //! @brief Copy the image informations without parsing the file again, but use a dedicated libtiff handle.
+    TIFFReader(const TIFFReader& other);
 
     ~TIFFReader() {
         this->tiffReader->closeImage();
+        delete this->tiffReader;
     }
 
+    //! @brief Use TIFFReaderMapped instead of libtiff to read the slices if the files allow it.
+    //! @param index If enabled, the strip layout of the image is read from it, or stored in it once known.
+    //! @return true if the memory mapping is used.
+    bool enableMemoryMapping(ImageIndex * index = nullptr);
+
+    void adviseSlice(int sliceIdx, SliceAdvice advice) const;
+
+    //! @note getValue() can be called by several threads at once on the same reader.
     uint16_t getValue(const glm::vec3& coord) const;
 
     template<typename DataType>
@@ -216,33 +569,87 @@ struct TIFFReader {
         // If we read directly from the raw image we use Nearest Neighbor interpolation
         const glm::ivec3 newCoord{std::floor(coord[0]), std::floor(coord[1]), std::floor(coord[2])};
         int imageIdx = newCoord[2];
-        this->tiffReader->setImageToRead(imageIdx);
-        tdata_t buf = _TIFFmalloc(this->tiffReader->getScanLineSize());
-        this->tiffReader->readScanline(buf, newCoord[1]);
-        DataType res = getToLowPrecision<DataType>(this->getInternalDataType(), buf, newCoord[0]);
-        _TIFFfree(buf);
-        return res;
+        DecodedRowCache::Block block;
+        tdata_t row = const_cast<uint8_t*>(this->getRow(imageIdx, newCoord[1], block));
+        return getToLowPrecision<DataType>(this->getInternalDataType(), row, newCoord[0] * this->nbChannels);
     }
 
+    //! @brief Get a row for a random access, from the memory mapping or from the decoded row cache.
+    //! @param block Keeps the decoded rows alive while the returned row is used.
+    const uint8_t * getRow(int sliceIdx, uint32 row, DecodedRowCache::Block& block) const;
+
     template <typename data_t>
     void getImage(int sliceIdx, std::vector<data_t>& result, std::pair<glm::vec3, glm::vec3> bboxes) const {
-        this->tiffReader->setImageToRead(sliceIdx);
+        result.reserve(result.size() + static_cast<std::size_t>(bboxes.second[0] - bboxes.first[0]) * (bboxes.second[1] - bboxes.first[1]));
+        dispatchOnDataType(this->getInternalDataType(), [&](auto typeTag) {
+            using image_data_t = typename decltype(typeTag)::type;
+            this->readRowsByBlock(sliceIdx, bboxes.first[1], bboxes.second[1], 1, [&](tdata_t row) {
+                castToUintAndInsert(static_cast<const image_data_t*>(row), result, 1, 1, bboxes, this->nbChannels);
+            });
+        });
+    }
 
-        tdata_t buf;
-        buf = _TIFFmalloc(this->tiffReader->getScanLineSize());
+    //! @brief Decode the rows [rowBegin, rowEnd[ of a slice strip by strip (or tile row by tile row)
+    //! and call processRow on every rowOffset-th row.
+    //! When the files are memory mapped, rows are given straight from the mapping without any decoding.
+    //! @return false if some blocks cannot be decoded, their rows are then given as zeros.
+    template <typename Function>
+    bool readRowsByBlock(int sliceIdx, uint32 rowBegin, uint32 rowEnd, uint32 rowOffset, Function&& processRow) const {
+        if(this->mappedReader) {
+            for(uint32 row = rowBegin; row < rowEnd; row += rowOffset) {
+                tdata_t rowData = const_cast<uint8_t*>(this->mappedReader->getRow(sliceIdx, row));
+                processRow(rowData);
+            }
+            return true;
+        }
 
-        uint32 row;
-        for (row = bboxes.first[1]; row < bboxes.second[1]; row+=1) {
-            this->tiffReader->readScanline(buf, row);
-            castToLowPrecision2(this->getInternalDataType(), buf, result, 1, 1, bboxes);
+        this->tiffReader->setImageToRead(sliceIdx);
+        const tsize_t scanlineSize = this->tiffReader->getScanLineSize();
+        const uint32 rowsPerBlock = this->tiffReader->getRowsPerBlock();
+        // Compressed blocks are decoded several at a time so that readRows() decodes them in parallel,
+        // unless some of them do not contain any requested row
+        uint32 blocksPerBatch = 1;
+        if(rowOffset <= rowsPerBlock && !omp_in_parallel() && this->tiffReader->isCompressed())
+            blocksPerBatch = TIFF_BLOCKS_PER_THREAD * omp_get_max_threads();
+        const uint32 rowsPerBatch = rowsPerBlock * blocksPerBatch;
+        uint8_t * buf = static_cast<uint8_t*>(_TIFFmalloc(scanlineSize * std::min(rowsPerBatch, rowEnd - rowBegin)));
+
+        bool success = true;
+        uint32 row = rowBegin;
+        while(row < rowEnd) {
+            const uint32 firstRow = row;
+            const uint32 lastRow = std::min((row / rowsPerBlock + blocksPerBatch) * rowsPerBlock, rowEnd);
+            if(!this->tiffReader->readRows(buf, firstRow, lastRow)) {
+                std::cout << "WARNING: cannot decode the rows [" << firstRow << ", " << lastRow << "[ of the slice [" << sliceIdx << "], they are read as zeros" << std::endl;
+                std::memset(buf, 0, (lastRow - firstRow) * scanlineSize);
+                success = false;
+            }
+            for(; row < lastRow; row += rowOffset) {
+                tdata_t rowData = buf + (row - firstRow) * scanlineSize;
+                processRow(rowData);
+            }
         }
         _TIFFfree(buf);
+        return success;
     }
 
     Image::ImageDataType getInternalDataType() const;
 
+    int getNbChannels() const {
+        return this->nbChannels;
+    }
+
     //! @brief See ImageReader::getSlice() .
-    void getSlice(int sliceIdx, std::vector<std::uint16_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes) const;
+    //! \note Instantiated for uint8_t and uint16_t results.
+    template <typename out_data_t>
+    void getSlice(int sliceIdx, std::vector<out_data_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes, SubsampleMethod subsampleMethod = SubsampleMethod::Skip) const;
+
+private:
+    //! @brief Protects tiffReader during the decoding of getRow().
+    mutable std::mutex decodeMutex;
+    //! @brief Number of rows and size in bytes of the blocks of rowCache, 0 until the first block is decoded.
+    mutable std::atomic<uint32> rowsPerCachedBlock;
+    mutable std::atomic<tsize_t> scanlineSize;
 };
 
 inline bool fileExist (const std::string& name) {
@@ -283,6 +690,8 @@ struct OMETIFFReader : public TIFFReader {
                 std::cout << "WARNING: the XML file contained in the first ome tiff file's comment has errors." << std::endl;
             }
             this->imgResolution[2] = this->tiffReader->filenames.size();
+            // The opened file may not be the first one of the list anymore
+            this->tiffReader->openedImage = -1;
         } else {
             std::cout << "WARNING: no XML data has been found in the first ome.tiff file. Those files will be parse as regular tiff files." << std::endl;
         }
@@ -290,136 +699,326 @@ struct OMETIFFReader : public TIFFReader {
 };
 
 
+//! @brief Reader of the BrainVISA DIM/IMA format: a ".dim" text header describing a ".ima" raw file.
+//!
+//! The ".ima" file is memory mapped, so opening an image do not read its data, and slices are converted directly from the mapping.
+//! The data type declared in the header ("-type") is used as is, like the TIFF internal data type.
+//! Only the first volume of 4D images is read.
 struct DIMReader {
 
     glm::vec3 voxelSize; // Read from the image, not necessarily the one used in the software
     glm::vec3 imgResolution;
     Image::ImageDataType imgDataType;
 
-    std::vector<uint16_t> data;
+    //! @param filename The ".dim" or ".ima" file, the other one is expected next to it with the same name.
+    DIMReader(const std::vector<std::string>& filename);
 
-    DIMReader(const std::vector<std::string>& filename) {
-        QString imaName = QString(filename[0].c_str());
+    //! @return false if the header or the data could not be read.
+    bool isValid() const;
 
-        imaName.replace(".dim", ".ima" );
-        std::ifstream imaFile (imaName.toUtf8());
-        if (!imaFile.is_open())
-            return;
-
-        std::ifstream dimFile (imaName.toUtf8());
-        if (!dimFile.is_open())
-            return;
+    //! @brief Nothing is done when the data are not read from the mapping.
+    void adviseSlice(int sliceIdx, SliceAdvice advice) const;
 
-        int n[3];
-        double d[3];
-
-        dimFile >> n[0]; dimFile >> n[1]; dimFile >> n[2];
+    uint16_t getValue(const glm::vec3& coord) const;
 
-        std::string dummy, type;
+    template<typename DataType>
+    DataType getValue(const glm::vec3& coord) const {
+        const glm::ivec3 newCoord{std::floor(coord[0]), std::floor(coord[1]), std::floor(coord[2])};
+        tdata_t row = const_cast<uint8_t*>(this->getRow(newCoord[2], newCoord[1]));
+        return getToLowPrecision<DataType>(this->getInternalDataType(), row, newCoord[0]);
+    }
 
-        dimFile >> dummy;
-        while (dummy.find("-type")==std::string::npos)
-            dimFile >> dummy;
+    Image::ImageDataType getInternalDataType() const {
+        return this->imgDataType;
+    }
 
-        //dimFile >> type;
+    int getNbChannels() const {
+        return 1;
+    }
 
-        while (dummy.find("-dx")==std::string::npos)
-            dimFile >> dummy;
+    //! @brief Address of a row in the mapped data.
+    const uint8_t * getRow(int sliceIdx, int row) const {
+        const std::size_t width = this->imgResolution[0];
+        const std::size_t height = this->imgResolution[1];
+        return this->data + ((sliceIdx * height + row) * width) * this->bytesPerVoxel;
+    }
 
-        dimFile >> d[0];
+    //! @brief Call processRow on every rowOffset-th row of [rowBegin, rowEnd[, without any copy. Same as TIFFReader::readRowsByBlock() .
+    template <typename Function>
+    void readRowsByBlock(int sliceIdx, uint32 rowBegin, uint32 rowEnd, uint32 rowOffset, Function&& processRow) const {
+        for(uint32 row = rowBegin; row < rowEnd; row += rowOffset)
+            processRow(const_cast<uint8_t*>(this->getRow(sliceIdx, row)));
+    }
 
-        dimFile >> dummy;
-        while (dummy.find("-dy")==std::string::npos)
-            dimFile >> dummy;
+    //! @brief See ImageReader::getSlice() .
+    template <typename out_data_t>
+    void getSlice(int sliceIdx, std::vector<out_data_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes, SubsampleMethod subsampleMethod = SubsampleMethod::Skip) const {
+        readSliceByRows(*this, sliceIdx, result, nbChannel, offsets, bboxes, subsampleMethod);
+    }
 
-        dimFile >> d[1];
+private:
+    int bytesPerVoxel;
+    //! @brief Start of the voxels, in the mapping of imaFile or in ownedData. Shared between the copies of the reader.
+    const uint8_t * data;
+    std::shared_ptr<QFile> imaFile;
+    //! @brief Used instead of the mapping when the data must be byte swapped or cannot be mapped.
+    std::shared_ptr<std::vector<uint8_t>> ownedData;
 
-        dimFile >> dummy;
-        while (dummy.find("-dz")==std::string::npos)
-            dimFile >> dummy;
+    bool readHeader(const std::string& dimFilename, bool& bigEndian);
+};
 
-        dimFile >> d[2];
+//! @brief Decompress the slices of a gzip compressed raw image, shared by the copies of a reader.
+//!
+//! A gzip stream can only be read forward: slices are decoded in order, and the recently decoded ones are kept
+//! in a DecodedRowCache so that the readers of several threads, which request slices in roughly increasing
+//! order, are served by a single decompression of the file. While decompressing, the state of the stream is saved
+//! every GZIP_CHECKPOINT_SPACING bytes at the end of a deflate block, so that requesting an already dropped slice
+//! restarts the decompression from the closest checkpoint before it instead of the beginning of the file.
+struct GzipSliceStream {
+    //! @param dataOffset Position of the first slice in the uncompressed data.
+    //! @param bytesPerVoxel The bytes of each voxel are reversed if swapBytes is true.
+    GzipSliceStream(const std::string& filename, std::size_t dataOffset, std::size_t sliceSize, int bytesPerVoxel, bool swapBytes);
+    ~GzipSliceStream();
+
+    bool isValid() const;
+
+    DecodedRowCache::Block getSlice(int sliceIdx);
+
+private:
+    //! @brief Position from where the decompression can restart, the deflate blocks do not start on byte boundaries.
+    struct Checkpoint {
+        uint64_t compressedOffset;// Of the first full byte of the next deflate block
+        int bits;// Number of bits of the next deflate block in the previous byte
+        uint64_t offset;// In the uncompressed data
+        std::vector<uint8_t> window;// Last 32K of uncompressed data, used as dictionary by the next deflate block
+    };
+
+    std::ifstream file;
+    z_stream stream;
+    bool streamReady;
+    //! @brief True when restarted from a checkpoint: the stream is then decoded as raw deflate data until the end of the gzip member.
+    bool raw;
+    std::vector<uint8_t> input;
+    //! @brief Position in the file of the end of input.
+    uint64_t compressedOffset;
+    //! @brief Number of uncompressed bytes before the next byte of the stream.
+    uint64_t offset;
+    //! @brief Last 32K of uncompressed data, as a circular buffer indexed by offset.
+    std::vector<uint8_t> history;
+    std::vector<Checkpoint> checkpoints;
+    std::size_t dataOffset;
+    std::size_t sliceSize;
+    int bytesPerVoxel;
+    bool swapBytes;
+    //! @brief Index of the next slice in the stream.
+    int nextSlice;
+    std::mutex mutex;
+    DecodedRowCache decodedSlices;
+
+    bool rewind();
+    //! @brief Restart the decompression from the last checkpoint before the slice, and skip the data up to it.
+    bool seekSlice(int sliceIdx);
+    //! @brief Restart the decompression as a raw deflate stream at the checkpoint.
+    bool restart(const Checkpoint& checkpoint);
+    //! @brief Decompress the next size bytes of the stream into data, or skip them if data is nullptr.
+    //! @return the number of bytes decompressed, smaller than size if the file is truncated or corrupted.
+    std::size_t inflateData(uint8_t * data, std::size_t size);
+    bool fillInput();
+    bool nextMember();
+    void addToHistory(const uint8_t * data, std::size_t size);
+    void addCheckpoint();
+};
 
+//! @brief Reader of single file NIfTI-1 images (".nii" and ".nii.gz").
+//!
+//! ".nii" files are memory mapped like DIM/IMA images, ".nii.gz" files are decompressed slice by slice with a GzipSliceStream.
+//! As for the other formats, the stored values are used without applying the scl_slope/scl_inter scaling
+//! of the header, and only the first volume of 4D images is read.
+struct NIFTIReader {
 
-        std::cout << "(nx,dx) = ( " << n[0] << " ; " << d[0] << " ) "<< std::endl;
-        std::cout << "(ny,dy) = ( " << n[1] << " ; " << d[1] << " ) "<< std::endl;
-        std::cout << "(nz,dz) = ( " << n[2] << " ; " << d[2] << " ) "<< std::endl;
+    glm::vec3 voxelSize; // Read from the image, not necessarily the one used in the software
+    glm::vec3 imgResolution;
+    Image::ImageDataType imgDataType;
 
-        unsigned int size = n[0]*n[1]*n[2];
-        unsigned int sizeIn = size;
+    NIFTIReader(const std::vector<std::string>& filename);
 
-        if( type.find("S16")!=std::string::npos )
-            sizeIn = size*2;
-        if( type.find("FLOAT")!=std::string::npos )
-            sizeIn = size*4;
+    //! @return false if the header or the data could not be read.
+    bool isValid() const;
 
-        unsigned char * data = new unsigned char[sizeIn];
+    //! @brief Nothing is done when the data are not read from the mapping.
+    void adviseSlice(int sliceIdx, SliceAdvice advice) const;
 
-        imaFile.read((char*)data, sizeIn);
+    uint16_t getValue(const glm::vec3& coord) const;
 
-        std::vector<uint16_t> _data(size);
+    template<typename DataType>
+    DataType getValue(const glm::vec3& coord) const {
+        const glm::ivec3 newCoord{std::floor(coord[0]), std::floor(coord[1]), std::floor(coord[2])};
+        DecodedRowCache::Block slice;
+        tdata_t row = const_cast<uint8_t*>(this->getRow(newCoord[2], newCoord[1], slice));
+        return getToLowPrecision<DataType>(this->getInternalDataType(), row, newCoord[0]);
+    }
 
-        if( type.find("S16")!=std::string::npos ){
-            for(unsigned int i = 0, j=0 ; i < size ; i ++, j+=2)
-                _data[i] = (uint16_t)data[j];
-        } else if( type.find("FLOAT")!=std::string::npos ){
-            float * floatArray = (float*) data;
+    Image::ImageDataType getInternalDataType() const {
+        return this->imgDataType;
+    }
 
-            for(unsigned int i = 0 ; i < size ; i ++)
-                _data[i] = (uint16_t)floatArray[i];
+    int getNbChannels() const {
+        return 1;
+    }
 
-            delete [] floatArray;
-        } else {
-            for(unsigned int i = 0 ; i < size ; i ++)
-                _data[i] = (uint16_t)data[i];
-        }
+    //! @brief Address of a slice, in the mapped data or decompressed.
+    //! @param slice Keeps the decompressed slice alive while it is used.
+    const uint8_t * getSliceData(int sliceIdx, DecodedRowCache::Block& slice) const;
 
-        this->imgResolution[0] = n[0];
-        this->imgResolution[1] = n[1];
-        this->imgResolution[2] = n[2];
-        this->voxelSize[0] = d[0];
-        this->voxelSize[1] = d[1];
-        this->voxelSize[2] = d[2];
-        this->imgDataType = (Image::ImageDataType::Unsigned | Image::ImageDataType::Bit_16);
+    const uint8_t * getRow(int sliceIdx, int row, DecodedRowCache::Block& slice) const {
+        return this->getSliceData(sliceIdx, slice) + row * this->rowSize;
+    }
 
-        delete [] data;
-        this->data = _data;
+    //! @brief Call processRow on every rowOffset-th row of [rowBegin, rowEnd[. Same as TIFFReader::readRowsByBlock() .
+    template <typename Function>
+    void readRowsByBlock(int sliceIdx, uint32 rowBegin, uint32 rowEnd, uint32 rowOffset, Function&& processRow) const {
+        DecodedRowCache::Block slice;
+        const uint8_t * sliceData = this->getSliceData(sliceIdx, slice);
+        for(uint32 row = rowBegin; row < rowEnd; row += rowOffset)
+            processRow(const_cast<uint8_t*>(sliceData + row * this->rowSize));
     }
 
-    ~DIMReader() {
+    //! @brief See ImageReader::getSlice() .
+    template <typename out_data_t>
+    void getSlice(int sliceIdx, std::vector<out_data_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes, SubsampleMethod subsampleMethod = SubsampleMethod::Skip) const {
+        readSliceByRows(*this, sliceIdx, result, nbChannel, offsets, bboxes, subsampleMethod);
     }
 
-    int from3DTo1D(const glm::vec3& p) const {
-        return p[0] + this->imgResolution[0] * p[1] + this->imgResolution[0] * this->imgResolution[1] * p[2]; 
+private:
+    int bytesPerVoxel;
+    std::size_t rowSize;
+    std::size_t sliceSize;
+    //! @brief Position of the voxels in the file.
+    std::size_t dataOffset;
+    //! @brief Start of the voxels of an uncompressed file, in the mapping of file or in ownedData. Shared between the copies of the reader.
+    const uint8_t * data;
+    std::shared_ptr<QFile> file;
+    //! @brief Used instead of the mapping when the data must be byte swapped or cannot be mapped.
+    std::shared_ptr<std::vector<uint8_t>> ownedData;
+    //! @brief Used instead of data for compressed files.
+    std::shared_ptr<GzipSliceStream> gzipStream;
+
+    bool readHeader(const std::string& filename, std::size_t& dataOffset, bool& swapBytes);
+};
+
+//! @brief Reader of the bricked images written by writeBrickedImage(), see BrickedImageHeader .
+//!
+//! The file is memory mapped, and the tiles of the bricks are decoded directly from the mapping, so the copies
+//! of the reader used by several threads share the same data without any lock.
+struct BrickedReader {
+
+    glm::vec3 voxelSize; // Read from the image, not necessarily the one used in the software
+    glm::vec3 imgResolution;
+    Image::ImageDataType imgDataType;
+
+    //! @brief Statistics of the whole image, read from the file.
+    ImageStatistics statistics;
+
+    BrickedReader(const std::vector<std::string>& filename);
+
+    //! @return false if the header or the data could not be read.
+    bool isValid() const;
+
+    int getBrickSize() const {
+        return this->header.brickSize;
     }
 
-    uint16_t getValue(const glm::vec3& coord) const {
-        return this->data[this->from3DTo1D(coord)];
+    uint16_t getValue(const glm::vec3& coord) const;
+
+    template<typename DataType>
+    DataType getValue(const glm::vec3& coord) const {
+        const glm::ivec3 newCoord{std::floor(coord[0]), std::floor(coord[1]), std::floor(coord[2])};
+        const int brickSize = this->header.brickSize;
+        DataType value = 0;
+        // Only the tile containing the voxel is decoded
+        dispatchOnDataType(this->imgDataType, [&](auto typeTag) {
+            using data_t = typename decltype(typeTag)::type;
+            thread_local std::vector<data_t> tile;
+            tile.resize(static_cast<std::size_t>(brickSize) * brickSize);
+            this->readTile(newCoord[2], newCoord[0] / brickSize, newCoord[1] / brickSize, tile.data(), brickSize);
+            tdata_t row = static_cast<tdata_t>(tile.data() + static_cast<std::size_t>(newCoord[1] % brickSize) * brickSize);
+            value = getToLowPrecision<DataType>(this->getInternalDataType(), row, newCoord[0] % brickSize);
+        });
+        return value;
     }
 
     Image::ImageDataType getInternalDataType() const {
         return this->imgDataType;
     }
 
-    //! @brief See ImageReader::getSlice() .
-    void getSlice(int sliceIdx, std::vector<std::uint16_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes) const {
-        float k = sliceIdx;
-        result.clear();
-        for(int j = bboxes.first[1]; j < bboxes.second[1]; j+=offsets.second) {
-            for(int i = bboxes.first[0]; i < bboxes.second[0]; i+=offsets.first) {
-                for(int l = 0; l < nbChannel; ++l) {
-                    result.push_back(this->from3DTo1D(glm::vec3(i, j, k)));
-                }
-            }
+    int getNbChannels() const {
+        return 1;
+    }
+
+    //! @brief Decode the tile of the slice sliceIdx in the brick column (brickX, brickY) into values.
+    //! @param rowStride Number of values between the rows of the tile in values.
+    template <typename data_t>
+    void readTile(int sliceIdx, int brickX, int brickY, data_t * values, std::size_t rowStride) const {
+        const BrickTile& tile = (*this->tiles)[this->header.getTileIdx(sliceIdx, brickX, brickY)];
+        const int brickSize = this->header.brickSize;
+        const int tileWidth = std::min(brickSize, static_cast<int>(this->imgResolution[0]) - brickX * brickSize);
+        const int tileHeight = std::min(brickSize, static_cast<int>(this->imgResolution[1]) - brickY * brickSize);
+        thread_local std::vector<data_t> decoded;
+        decoded.resize(static_cast<std::size_t>(tileWidth) * tileHeight);
+        if(!decodeTile(this->data + tile.offset, tile, decoded.data(), decoded.size())) {
+            std::cout << "WARNING: corrupted tile in slice [" << sliceIdx << "] of the bricked image" << std::endl;
+            std::fill(decoded.begin(), decoded.end(), 0);
         }
+        for(int y = 0; y < tileHeight; ++y)
+            std::copy(decoded.data() + static_cast<std::size_t>(y) * tileWidth, decoded.data() + static_cast<std::size_t>(y + 1) * tileWidth, values + y * rowStride);
     }
+
+    //! @brief True if the tile of the slice sliceIdx in the brick column (brickX, brickY) only has zeros, without reading the whole tile.
+    //! Only the tiles compressed to a few bytes are decoded, as a tile of zeros is a single run, the other ones are not empty.
+    bool isTileEmpty(int sliceIdx, int brickX, int brickY) const;
+
+    //! @brief Call processRow on every rowOffset-th row of [rowBegin, rowEnd[. Same as TIFFReader::readRowsByBlock() .
+    //! Rows are decoded brick by brick, by blocks of brickSize rows, and the blocks without any requested row are skipped.
+    template <typename Function>
+    void readRowsByBlock(int sliceIdx, uint32 rowBegin, uint32 rowEnd, uint32 rowOffset, Function&& processRow) const {
+        const int width = this->imgResolution[0];
+        const int brickSize = this->header.brickSize;
+        const glm::ivec3 nbBricks = this->header.getNbBricks();
+        dispatchOnDataType(this->imgDataType, [&](auto typeTag) {
+            using data_t = typename decltype(typeTag)::type;
+            std::vector<data_t> rows(static_cast<std::size_t>(width) * brickSize);
+            uint32 row = rowBegin;
+            while(row < rowEnd) {
+                const int brickY = row / brickSize;
+                for(int brickX = 0; brickX < nbBricks.x; ++brickX)
+                    this->readTile(sliceIdx, brickX, brickY, rows.data() + brickX * brickSize, width);
+                const uint32 blockEnd = std::min<uint32>(rowEnd, (brickY + 1) * brickSize);
+                for(; row < blockEnd; row += rowOffset)
+                    processRow(static_cast<tdata_t>(rows.data() + static_cast<std::size_t>(row - brickY * brickSize) * width));
+            }
+        });
+    }
+
+    //! @brief See ImageReader::getSlice() .
+    template <typename out_data_t>
+    void getSlice(int sliceIdx, std::vector<out_data_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes, SubsampleMethod subsampleMethod = SubsampleMethod::Skip) const {
+        readSliceByRows(*this, sliceIdx, result, nbChannel, offsets, bboxes, subsampleMethod);
+    }
+
+private:
+    BrickedImageHeader header;
+    //! @brief Start of the mapping of file, or of ownedData. Shared between the copies of the reader.
+    const uint8_t * data;
+    std::shared_ptr<QFile> file;
+    //! @brief Used instead of the mapping when the file cannot be mapped.
+    std::shared_ptr<std::vector<uint8_t>> ownedData;
+    std::shared_ptr<const std::vector<BrickTile>> tiles;
 };
 
-//! @brief Provides functions to read values from a TIFF, OME-TIFF or DIM-IMA image.
-//! \warning DIM-IMA reader has not been maintained from a long time and is not available for the user.
+//! @brief Provides functions to read values from a TIFF, OME-TIFF, DIM-IMA, NIfTI or bricked image.
 //! \note
 //! This class do not implement any writing functions.
-//! The only functions to write images are Scene::writeDeformedImageTemplated() and Scene::writeGreyscaleTIFFImage() .
+//! The only functions to write images are Scene::writeDeformedImageTemplated(), Scene::writeGreyscaleTIFFImage() and writeBrickedImage() .
 struct ImageReader {
 
     ImageFormat imageFormat;
@@ -427,53 +1026,159 @@ struct ImageReader {
     TIFFReader * tiffImageReader;
     OMETIFFReader * omeTiffImageReader;
     DIMReader * dimImageReader;
+    NIFTIReader * niftiImageReader;
+    BrickedReader * brickedImageReader;
 
     glm::vec3 voxelSize; // Read from the image, not necessarily the one used in the software
     glm::vec3 imgResolution;
     Image::ImageDataType imgDataType;
+    //! @brief Number of channels of the image, only multi-channel (multi-sample) TIFF and OME-TIFF images have more than one.
+    int nbChannels;
 
     uint16_t maxValue;
     uint16_t minValue;
 
-    ImageReader(const std::vector<std::string>& filename) {
+    //! @brief Sidecar index of the image, see ImageIndex . Disabled unless asked when opening a TIFF image.
+    ImageIndex index;
+
+    //! @brief Distance between the slices read by getSlice() in streaming mode, 0 if disabled. See setStreamingIngestion() .
+    int streamingStep;
+    //! @brief Last slice read ahead in streaming mode, shared with the copies of the reader so that each slice is advised only once.
+    std::shared_ptr<std::atomic<int>> lastAdvisedSlice;
+
+    //! @param useIndexFile Read the metadata of a TIFF image from its index file, and create it if it does not exist yet. See ImageIndex .
+    //! @throw std::runtime_error if the image cannot be read, e.g. a truncated or invalid file.
+    ImageReader(const std::vector<std::string>& filename, bool useIndexFile = false): streamingStep(0) {
+        this->openReader(filename, useIndexFile);
+        if(!this->isValid()) {
+            // The destructor is not called when the constructor throws
+            delete this->brickedImageReader;
+            delete this->niftiImageReader;
+            delete this->dimImageReader;
+            throw std::runtime_error("ERROR: the image [" + filename[0] + "] cannot be read");
+        }
+        if(this->index.isEnabled() && !this->index.isLoaded()) {
+            std::vector<uint64_t> directoryOffsets;
+            if(this->tiffImageReader)
+                directoryOffsets.assign(this->tiffImageReader->tiffReader->directoryOffsets.begin(), this->tiffImageReader->tiffReader->directoryOffsets.end());
+            this->index.setMetadata(this->imgResolution, this->voxelSize, this->imgDataType, directoryOffsets);
+        }
+    }
+
+    void openReader(const std::vector<std::string>& filename, bool useIndexFile = false) {
+        this->nbChannels = 1;
         std::string extension = filename[0].substr(filename[0].find_last_of(".") + 1);
+        if(extension == "bvol") {
+            this->imageFormat = ImageFormat::BRICKED;
+            this->tiffImageReader = nullptr;
+            this->omeTiffImageReader = nullptr;
+            this->dimImageReader = nullptr;
+            this->niftiImageReader = nullptr;
+            this->brickedImageReader = new BrickedReader(filename);
+            this->voxelSize = this->brickedImageReader->voxelSize;
+            this->imgResolution = this->brickedImageReader->imgResolution;
+            this->imgDataType = this->brickedImageReader->imgDataType;
+            // Known without reading the image
+            this->minValue = this->brickedImageReader->statistics.minValue;
+            this->maxValue = this->brickedImageReader->statistics.maxValue;
+            return;
+        }
+
+        if(extension == "nii" || (extension == "gz" && filename[0].size() > 7 && filename[0].substr(filename[0].size() - 7) == ".nii.gz")) {
+            this->imageFormat = ImageFormat::NIFTI;
+            this->tiffImageReader = nullptr;
+            this->omeTiffImageReader = nullptr;
+            this->dimImageReader = nullptr;
+            this->brickedImageReader = nullptr;
+            this->niftiImageReader = new NIFTIReader(filename);
+            this->voxelSize = this->niftiImageReader->voxelSize;
+            this->imgResolution = this->niftiImageReader->imgResolution;
+            this->imgDataType = this->niftiImageReader->imgDataType;
+            return;
+        }
+
+        if(extension == "dim" || extension == "ima") {
+            this->imageFormat = ImageFormat::DIM_IMA;
+            this->tiffImageReader = nullptr;
+            this->omeTiffImageReader = nullptr;
+            this->niftiImageReader = nullptr;
+            this->brickedImageReader = nullptr;
+            this->dimImageReader = new DIMReader(filename);
+            this->voxelSize = this->dimImageReader->voxelSize;
+            this->imgResolution = this->dimImageReader->imgResolution;
+            this->imgDataType = this->dimImageReader->imgDataType;
+            return;
+        }
+
+        // Other extensions are read as TIFF
         if(filename.size() > 0 || extension == "tif" || extension == "tiff") {
             if(filename[0].substr(filename[0].find_first_of(".") + 1).find("ome")!=std::string::npos) {
                 this->imageFormat = ImageFormat::OME_TIFF;
                 this->omeTiffImageReader = new OMETIFFReader(filename);
+                this->omeTiffImageReader->enableMemoryMapping();
                 this->tiffImageReader = nullptr;
                 this->dimImageReader = nullptr;
+                this->niftiImageReader = nullptr;
+                this->brickedImageReader = nullptr;
                 this->voxelSize = this->omeTiffImageReader->voxelSize;
                 this->imgResolution = this->omeTiffImageReader->imgResolution;
                 this->imgDataType = this->omeTiffImageReader->imgDataType;
+                this->nbChannels = this->omeTiffImageReader->nbChannels;
                 return;
             } else {
                 this->imageFormat = ImageFormat::TIFF;
-                this->tiffImageReader = new TIFFReader(filename);
+                // Only the TIFF reader has metadata worth caching: its directories are otherwise walked at each opening
+                if(useIndexFile)
+                    this->index = ImageIndex(filename);
+                this->tiffImageReader = new TIFFReader(filename, &this->index);
+                this->tiffImageReader->enableMemoryMapping(&this->index);
                 this->omeTiffImageReader = nullptr;
                 this->dimImageReader = nullptr;
+                this->niftiImageReader = nullptr;
+                this->brickedImageReader = nullptr;
                 this->voxelSize = this->tiffImageReader->voxelSize;
                 this->imgResolution = this->tiffImageReader->imgResolution;
                 this->imgDataType = this->tiffImageReader->imgDataType;
+                this->nbChannels = this->tiffImageReader->nbChannels;
                 return;
             }
         }
+    }
 
-        if(extension == "dim" || extension == "ima") {
-            this->imageFormat = ImageFormat::DIM_IMA;
-            this->tiffImageReader = nullptr;
-            this->omeTiffImageReader = nullptr;
-            this->dimImageReader = new DIMReader(filename);
-            this->voxelSize = this->dimImageReader->voxelSize;
-            this->imgResolution = this->dimImageReader->imgResolution;
-            this->imgDataType = this->dimImageReader->imgDataType;
-            return;
+    //! @brief Duplicate the reader with its own file handles, as a single reader cannot be used by several threads at once.
+    ImageReader(const ImageReader& other): imageFormat(other.imageFormat), tiffImageReader(nullptr), omeTiffImageReader(nullptr), dimImageReader(nullptr), niftiImageReader(nullptr), brickedImageReader(nullptr), voxelSize(other.voxelSize), imgResolution(other.imgResolution), imgDataType(other.imgDataType), nbChannels(other.nbChannels), maxValue(other.maxValue), minValue(other.minValue), index(other.index), streamingStep(other.streamingStep), lastAdvisedSlice(other.lastAdvisedSlice) {
+        if(other.tiffImageReader)
+            this->tiffImageReader = new TIFFReader(*other.tiffImageReader);
+        if(other.omeTiffImageReader)
+            this->omeTiffImageReader = new OMETIFFReader(*other.omeTiffImageReader);
+        if(other.dimImageReader)
+            this->dimImageReader = new DIMReader(*other.dimImageReader);
+        if(other.niftiImageReader)
+            this->niftiImageReader = new NIFTIReader(*other.niftiImageReader);
+        if(other.brickedImageReader)
+            this->brickedImageReader = new BrickedReader(*other.brickedImageReader);
+    }
+
+    //! @brief False if the file of a DIM/IMA, NIfTI or bricked image cannot be read. The TIFF readers check their files when reading them.
+    bool isValid() const {
+        switch(this->imageFormat) {
+            case ImageFormat::DIM_IMA :
+                return this->dimImageReader->isValid();
+            case ImageFormat::NIFTI :
+                return this->niftiImageReader->isValid();
+            case ImageFormat::BRICKED :
+                return this->brickedImageReader->isValid();
+            default :
+                return true;
         }
     }
 
     ~ImageReader() {
+        delete this->brickedImageReader;
+        delete this->niftiImageReader;
         delete this->dimImageReader;
         delete this->tiffImageReader;
+        delete this->omeTiffImageReader;
     }
 
     uint16_t getValue(const glm::vec3& coord) const {
@@ -487,6 +1192,12 @@ struct ImageReader {
             case ImageFormat::OME_TIFF :
                 return this->omeTiffImageReader->getValue(coord);
                 break;
+            case ImageFormat::NIFTI :
+                return this->niftiImageReader->getValue(coord);
+                break;
+            case ImageFormat::BRICKED :
+                return this->brickedImageReader->getValue(coord);
+                break;
         }
     }
 
@@ -497,11 +1208,17 @@ struct ImageReader {
                 return this->tiffImageReader->getValue<DataType>(coord);
                 break;
             case ImageFormat::DIM_IMA :
-                return 0.; 
+                return this->dimImageReader->getValue<DataType>(coord);
                 break;
             case ImageFormat::OME_TIFF :
                 return 0.;
                 break;
+            case ImageFormat::NIFTI :
+                return this->niftiImageReader->getValue<DataType>(coord);
+                break;
+            case ImageFormat::BRICKED :
+                return this->brickedImageReader->getValue<DataType>(coord);
+                break;
         }
     }
 
@@ -509,26 +1226,92 @@ struct ImageReader {
         return this->imgDataType;
     }
 
+    int getNbChannels() const {
+        return this->nbChannels;
+    }
+
+    //! @brief Streaming mode, for a single pass over an image that may not fit in RAM, e.g. when a Cache is filled.
+    //!
+    //! After each slice read by getSlice(), the kernel is told to drop it from the page cache, so that a large image
+    //! does not evict the working set of the other processes, and to read the next STREAMING_READ_AHEAD slices in the background,
+    //! with large requests, so that the reader do not wait for small synchronous reads.
+    //! Only the TIFF and raw (DIM/IMA, uncompressed NIfTI) images are concerned.
+    //! @param sliceStep Distance between the slices that will be read, 0 to disable the streaming mode.
+    void setStreamingIngestion(int sliceStep) {
+        this->streamingStep = sliceStep;
+        this->lastAdvisedSlice = std::make_shared<std::atomic<int>>(-1);
+    }
+
+    void adviseSlice(int sliceIdx, SliceAdvice advice) const {
+        if(sliceIdx < 0 || sliceIdx >= this->imgResolution[2])
+            return;
+        switch(this->imageFormat) {
+            case ImageFormat::TIFF :
+                this->tiffImageReader->adviseSlice(sliceIdx, advice);
+                break;
+            case ImageFormat::DIM_IMA :
+                this->dimImageReader->adviseSlice(sliceIdx, advice);
+                break;
+            case ImageFormat::OME_TIFF :
+                this->omeTiffImageReader->adviseSlice(sliceIdx, advice);
+                break;
+            case ImageFormat::NIFTI :
+                this->niftiImageReader->adviseSlice(sliceIdx, advice);
+                break;
+            case ImageFormat::BRICKED :
+                break;
+        }
+    }
+
+    //! @brief Number of consecutive slices stored together in the file, reading them together avoids to seek back and forth.
+    int getSlicesPerBlock() const {
+        if(this->brickedImageReader)
+            return this->brickedImageReader->getBrickSize();
+        return 1;
+    }
+
     //! @brief Get one image of an image stack.
     //! @param sliceIdx Image index to get.
-    //! @param nbChannel WARNING: this parameter isn't fully supported yet, for now it just duplicate the data to simulate multiple channels.
+    //! @param nbChannel Number of values per voxel in result. The value l of a voxel is its channel min(l, getNbChannels() - 1),
+    //! so a single channel image is duplicated, and all the channels of a multi-channel image are decoded in a single pass.
     //! @param offsets With offsets = {1, 1}, no pixel are skipped and a slice at the original image resolution is returned.
     //! With offsets = {2, 1}, all pixels with odd x coordinates will be skipped, which result with a slice with
     //! half the resolution on the x axis.
     //! With offsets = {3, 3}, the result image resolution will be divided per 3 on x and y axis.
     //! @param bboxes Allow to query only a subregion of the image using this bbox.
+    //! @param subsampleMethod With SubsampleMethod::Skip the pixels are skipped as described above, with SubsampleMethod::Mean
+    //! each resulting pixel is the mean of the offsets.first * offsets.second pixels it replaces.
     //! @note As the z axis is fixed (the sliceIdx parameter), you cannot change the z resolution
-    void getSlice(int sliceIdx, std::vector<std::uint16_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes) const {
+    //! @note The values are returned as uint8_t or uint16_t, use uint8_t only for 8 bits images.
+    template <typename out_data_t>
+    void getSlice(int sliceIdx, std::vector<out_data_t>& result, int nbChannel, std::pair<int, int>  offsets, std::pair<glm::vec3, glm::vec3> bboxes, SubsampleMethod subsampleMethod = SubsampleMethod::Skip) const {
         switch(this->imageFormat) {
             case ImageFormat::TIFF :
-                this->tiffImageReader->getSlice(sliceIdx, result, nbChannel, offsets, bboxes);
+                this->tiffImageReader->getSlice(sliceIdx, result, nbChannel, offsets, bboxes, subsampleMethod);
                 break;
             case ImageFormat::DIM_IMA :
-                this->dimImageReader->getSlice(sliceIdx, result, nbChannel, offsets, bboxes);
+                this->dimImageReader->getSlice(sliceIdx, result, nbChannel, offsets, bboxes, subsampleMethod);
                 break;
             case ImageFormat::OME_TIFF :
-                this->omeTiffImageReader->getSlice(sliceIdx, result, nbChannel, offsets, bboxes);
+                this->omeTiffImageReader->getSlice(sliceIdx, result, nbChannel, offsets, bboxes, subsampleMethod);
+                break;
+            case ImageFormat::NIFTI :
+                this->niftiImageReader->getSlice(sliceIdx, result, nbChannel, offsets, bboxes, subsampleMethod);
                 break;
+            case ImageFormat::BRICKED :
+                this->brickedImageReader->getSlice(sliceIdx, result, nbChannel, offsets, bboxes, subsampleMethod);
+                break;
+        }
+        if(this->streamingStep > 0) {
+            this->adviseSlice(sliceIdx, SliceAdvice::DontNeed);
+            // Only the slices not read ahead yet by this reader or its copies are advised
+            const int lastSlice = sliceIdx + STREAMING_READ_AHEAD * this->streamingStep;
+            int advisedSlice = this->lastAdvisedSlice->load();
+            while(advisedSlice < lastSlice && !this->lastAdvisedSlice->compare_exchange_weak(advisedSlice, lastSlice)) {}
+            for(int i = 1; i <= STREAMING_READ_AHEAD; ++i) {
+                if(sliceIdx + i * this->streamingStep > advisedSlice)
+                    this->adviseSlice(sliceIdx + i * this->streamingStep, SliceAdvice::WillNeed);
+            }
         }
     }
 };
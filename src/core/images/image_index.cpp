@@ -0,0 +1,196 @@
+#include "image_index.hpp"
+#include <QFileInfo>
+#include <QDateTime>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace {
+    const int indexFileVersion = 3;
+
+    std::vector<int> toRatioKey(const glm::vec3& resolutionRatio) {
+        return {static_cast<int>(resolutionRatio[0]), static_cast<int>(resolutionRatio[1]), static_cast<int>(resolutionRatio[2])};
+    }
+}
+
+ImageIndex::ImageIndex(): imgResolution(0., 0., 0.), voxelSize(1., 1., 1.), imgDataType(Image::ImageDataType::Unknown), scanlineSize(0), rowsPerStrip(0), loaded(false), hasMetadata(false), stripLayoutKnown(false) {}
+
+ImageIndex::ImageIndex(const std::vector<std::string>& filenames): ImageIndex() {
+    if(filenames.empty())
+        return;
+    this->indexFilename = filenames[0] + ".index";
+
+    // Every file is part of the key: a single slice rewritten in place must invalidate the directory offsets
+    this->key = {static_cast<long long>(filenames.size())};
+    for(const std::string& filename : filenames) {
+        const QFileInfo info(QString(filename.c_str()));
+        this->key.push_back(static_cast<long long>(info.size()));
+        this->key.push_back(static_cast<long long>(info.lastModified().toMSecsSinceEpoch()));
+    }
+
+    this->loaded = this->read();
+    if(this->loaded)
+        std::cout << "Image informations read from [" << this->indexFilename << "]" << std::endl;
+}
+
+bool ImageIndex::isEnabled() const {
+    return !this->indexFilename.empty();
+}
+
+bool ImageIndex::isLoaded() const {
+    return this->loaded;
+}
+
+void ImageIndex::setMetadata(const glm::vec3& imgResolution, const glm::vec3& voxelSize, Image::ImageDataType imgDataType, const std::vector<uint64_t>& directoryOffsets) {
+    this->imgResolution = imgResolution;
+    this->voxelSize = voxelSize;
+    this->imgDataType = imgDataType;
+    this->directoryOffsets = directoryOffsets;
+    this->hasMetadata = true;
+    this->write();
+}
+
+bool ImageIndex::hasStripLayout() const {
+    return this->stripLayoutKnown;
+}
+
+void ImageIndex::setStripLayout(int64_t scanlineSize, uint32_t rowsPerStrip, const std::vector<int>& sliceFile, const std::vector<std::vector<uint64_t>>& sliceStripOffsets) {
+    this->scanlineSize = scanlineSize;
+    this->rowsPerStrip = rowsPerStrip;
+    this->sliceFile = sliceFile;
+    this->sliceStripOffsets = sliceStripOffsets;
+    this->stripLayoutKnown = true;
+    this->write();
+}
+
+bool ImageIndex::getMinMax(const glm::vec3& resolutionRatio, uint16_t& minValue, uint16_t& maxValue) const {
+    auto it = this->minMaxValues.find(toRatioKey(resolutionRatio));
+    if(it == this->minMaxValues.end())
+        return false;
+    minValue = it->second.first;
+    maxValue = it->second.second;
+    return true;
+}
+
+void ImageIndex::setMinMax(const glm::vec3& resolutionRatio, uint16_t minValue, uint16_t maxValue) {
+    this->minMaxValues[toRatioKey(resolutionRatio)] = std::make_pair(minValue, maxValue);
+    this->write();
+}
+
+bool ImageIndex::read() {
+    std::ifstream file(this->indexFilename);
+    if(!file.is_open())
+        return false;
+
+    std::string tag;
+    int version = 0;
+    file >> tag >> version;
+    if(tag != "version" || version != indexFileVersion)
+        return false;
+
+    file >> tag;
+    if(tag != "key")
+        return false;
+    for(long long expected : this->key) {
+        long long value = 0;
+        file >> value;
+        if(value != expected) {
+            std::cout << "INFO: [" << this->indexFilename << "] is outdated and will be rewritten" << std::endl;
+            return false;
+        }
+    }
+
+    int dataType = 0;
+    std::size_t nbDirectories = 0;
+    file >> tag >> this->imgResolution[0] >> this->imgResolution[1] >> this->imgResolution[2];
+    file >> tag >> this->voxelSize[0] >> this->voxelSize[1] >> this->voxelSize[2];
+    file >> tag >> dataType;
+    file >> tag >> nbDirectories;
+    this->imgDataType = static_cast<Image::ImageDataType>(dataType);
+    this->directoryOffsets.resize(nbDirectories);
+    for(uint64_t& offset : this->directoryOffsets)
+        file >> offset;
+    if(file.fail())
+        return false;
+
+    int layoutKnown = 0;
+    std::size_t nbSlices = 0;
+    file >> tag >> layoutKnown >> this->scanlineSize >> this->rowsPerStrip >> nbSlices;
+    this->sliceFile.resize(nbSlices);
+    this->sliceStripOffsets.resize(nbSlices);
+    const std::size_t nbStrips = (this->rowsPerStrip > 0) ? (static_cast<std::size_t>(this->imgResolution[1]) + this->rowsPerStrip - 1) / this->rowsPerStrip : 0;
+    for(std::size_t slice = 0; slice < nbSlices; ++slice) {
+        long long nbOffsets = 0;
+        file >> this->sliceFile[slice] >> nbOffsets;
+        std::vector<uint64_t>& offsets = this->sliceStripOffsets[slice];
+        if(nbOffsets < 0) {
+            // Contiguous strips, only the first offset is stored
+            uint64_t firstOffset = 0;
+            file >> firstOffset;
+            for(std::size_t strip = 0; strip < nbStrips; ++strip)
+                offsets.push_back(firstOffset + strip * this->rowsPerStrip * this->scanlineSize);
+        } else {
+            offsets.resize(nbOffsets);
+            for(uint64_t& offset : offsets)
+                file >> offset;
+        }
+    }
+    if(file.fail())
+        return false;
+    this->stripLayoutKnown = (layoutKnown != 0);
+
+    while(file >> tag && tag == "minmax") {
+        std::vector<int> ratio(3, 1);
+        int minValue = 0;
+        int maxValue = 0;
+        file >> ratio[0] >> ratio[1] >> ratio[2] >> minValue >> maxValue;
+        this->minMaxValues[ratio] = std::make_pair(static_cast<uint16_t>(minValue), static_cast<uint16_t>(maxValue));
+    }
+
+    this->hasMetadata = true;
+    return true;
+}
+
+void ImageIndex::write() const {
+    if(!this->isEnabled() || !this->hasMetadata)
+        return;
+
+    std::ofstream file(this->indexFilename);
+    if(!file.is_open()) {
+        std::cout << "WARNING: cannot write the index file [" << this->indexFilename << "]" << std::endl;
+        return;
+    }
+
+    file.precision(std::numeric_limits<float>::max_digits10);
+    file << "version " << indexFileVersion << std::endl;
+    file << "key";
+    for(long long value : this->key)
+        file << " " << value;
+    file << std::endl;
+    file << "resolution " << this->imgResolution[0] << " " << this->imgResolution[1] << " " << this->imgResolution[2] << std::endl;
+    file << "voxelsize " << this->voxelSize[0] << " " << this->voxelSize[1] << " " << this->voxelSize[2] << std::endl;
+    file << "datatype " << static_cast<int>(this->imgDataType) << std::endl;
+    file << "directories " << this->directoryOffsets.size();
+    for(uint64_t offset : this->directoryOffsets)
+        file << " " << offset;
+    file << std::endl;
+    file << "strips " << (this->stripLayoutKnown ? 1 : 0) << " " << this->scanlineSize << " " << this->rowsPerStrip << " " << this->sliceFile.size() << std::endl;
+    const std::size_t nbStrips = (this->rowsPerStrip > 0) ? (static_cast<std::size_t>(this->imgResolution[1]) + this->rowsPerStrip - 1) / this->rowsPerStrip : 0;
+    for(std::size_t slice = 0; slice < this->sliceFile.size(); ++slice) {
+        const std::vector<uint64_t>& offsets = this->sliceStripOffsets[slice];
+        bool contiguous = !offsets.empty() && offsets.size() == nbStrips;
+        for(std::size_t strip = 0; contiguous && strip < offsets.size(); ++strip)
+            contiguous = (offsets[strip] == offsets[0] + strip * this->rowsPerStrip * this->scanlineSize);
+        file << this->sliceFile[slice];
+        if(contiguous) {
+            file << " -1 " << offsets[0];
+        } else {
+            file << " " << offsets.size();
+            for(uint64_t offset : offsets)
+                file << " " << offset;
+        }
+        file << std::endl;
+    }
+    for(const auto& minMax : this->minMaxValues)
+        file << "minmax " << minMax.first[0] << " " << minMax.first[1] << " " << minMax.first[2] << " " << minMax.second.first << " " << minMax.second.second << std::endl;
+}
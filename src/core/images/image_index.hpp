@@ -0,0 +1,68 @@
+#ifndef IMAGE_INDEX_HPP_
+#define IMAGE_INDEX_HPP_
+
+#include "../../legacy/image/utils/include/image_api_common.hpp"
+#include <string>
+#include <vector>
+#include <map>
+
+//! \addtogroup img
+//! @{
+
+//! @brief Sidecar file storing what ImageReader and Scene otherwise recompute by scanning the whole image at each opening.
+//!
+//! The index is optional and only used by the TIFF reader, see ImageReader::ImageReader() .
+//! It is written next to the first file of the image, as "<filename>.index". It contains the resolution,
+//! voxel size, data type, TIFF directory offsets and strip layout of the image, and the min/max values of the grids
+//! that have already been loaded from it, for each resolution ratio.
+//! An index file is only used if the number of files, and the size and modification date of every file of the image
+//! are the same as when it was written. Otherwise it is ignored and overwritten.
+struct ImageIndex {
+
+    std::string indexFilename;
+
+    glm::vec3 imgResolution;
+    glm::vec3 voxelSize;
+    Image::ImageDataType imgDataType;
+    std::vector<uint64_t> directoryOffsets;
+
+    //! @brief Strips of each slice read by TIFFReaderMapped, so that it does not walk the TIFF directories. See hasStripLayout() .
+    //! rowsPerStrip is 0 if the layout of the image does not allow to map it.
+    int64_t scanlineSize;
+    uint32_t rowsPerStrip;
+    std::vector<int> sliceFile;
+    std::vector<std::vector<uint64_t>> sliceStripOffsets;
+
+    //! @brief Disabled index, that is never read nor written.
+    ImageIndex();
+    ImageIndex(const std::vector<std::string>& filenames);
+
+    bool isEnabled() const;
+
+    //! @brief True if the image metadata have been read from an up-to-date index file.
+    bool isLoaded() const;
+
+    //! @brief Store the image metadata and write the index file.
+    void setMetadata(const glm::vec3& imgResolution, const glm::vec3& voxelSize, Image::ImageDataType imgDataType, const std::vector<uint64_t>& directoryOffsets);
+
+    bool hasStripLayout() const;
+    void setStripLayout(int64_t scanlineSize, uint32_t rowsPerStrip, const std::vector<int>& sliceFile, const std::vector<std::vector<uint64_t>>& sliceStripOffsets);
+
+    //! @brief Get the min/max values of a grid loaded with resolutionRatio, if they have already been computed.
+    bool getMinMax(const glm::vec3& resolutionRatio, uint16_t& minValue, uint16_t& maxValue) const;
+    void setMinMax(const glm::vec3& resolutionRatio, uint16_t minValue, uint16_t maxValue);
+
+private:
+    bool loaded;
+    bool hasMetadata;
+    bool stripLayoutKnown;
+    std::vector<long long> key;
+    std::map<std::vector<int>, std::pair<uint16_t, uint16_t>> minMaxValues;
+
+    bool read();
+    void write() const;
+};
+
+//! @}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef PREFETCHER_HPP_
+#define PREFETCHER_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! \addtogroup img
+//! @{
+
+//! @brief Read the slices [firstSlice, endSlice[ of an image in a background thread, ahead of a sequential consumer.
+//!
+//! Up to depth slices are read in advance while the consumer processes the current one, so that a sequential
+//! pass over the image costs max(I/O, processing) instead of their sum.
+//! \warning The read function is called from the background thread: it must use its own reader,
+//! as a libtiff handle cannot be shared between threads. An exception thrown by the read function stops the reading,
+//! and is thrown again by getNextSlice() in the consumer thread once the slices read before are consumed.
+template <typename data_t>
+class SlicePrefetcher {
+public:
+    using ReadFunction = std::function<void(int sliceIdx, std::vector<data_t>& slice)>;
+
+    SlicePrefetcher(ReadFunction readSlice, int firstSlice, int endSlice, int depth = 4):
+        readSlice(readSlice), firstSlice(firstSlice), endSlice(endSlice), depth(std::max(1, depth)), stop(false), finished(false) {
+        this->thread = std::thread(&SlicePrefetcher::run, this);
+    }
+
+    ~SlicePrefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stop = true;
+        }
+        this->condition.notify_all();
+        this->thread.join();
+    }
+
+    //! @brief Wait for the next slice and swap it into result. The previous content of result is recycled for a later read.
+    //! @return The index of the slice, or -1 when all the slices have been consumed.
+    int getNextSlice(std::vector<data_t>& result) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->condition.wait(lock, [this](){ return !this->readySlices.empty() || this->finished; });
+        if(this->readySlices.empty()) {
+            if(this->error)
+                std::rethrow_exception(this->error);
+            return -1;
+        }
+        const int sliceIdx = this->readySlices.front().first;
+        result.swap(this->readySlices.front().second);
+        this->freeBuffers.push_back(std::move(this->readySlices.front().second));
+        this->readySlices.pop_front();
+        lock.unlock();
+        this->condition.notify_all();
+        return sliceIdx;
+    }
+
+private:
+    ReadFunction readSlice;
+    int firstSlice;
+    int endSlice;
+    int depth;
+
+    bool stop;
+    bool finished;
+    //! @brief Exception thrown by readSlice in the background thread, where it would terminate the application.
+    std::exception_ptr error;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::pair<int, std::vector<data_t>>> readySlices;
+    std::vector<std::vector<data_t>> freeBuffers;
+
+    void run() {
+        for(int sliceIdx = this->firstSlice; sliceIdx < this->endSlice; ++sliceIdx) {
+            std::vector<data_t> slice;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->condition.wait(lock, [this](){ return this->stop || static_cast<int>(this->readySlices.size()) < this->depth; });
+                if(this->stop)
+                    return;
+                if(!this->freeBuffers.empty()) {
+                    slice.swap(this->freeBuffers.back());
+                    this->freeBuffers.pop_back();
+                }
+            }
+            slice.clear();
+            try {
+                this->readSlice(sliceIdx, slice);
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->error = std::current_exception();
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->readySlices.emplace_back(sliceIdx, std::move(slice));
+            }
+            this->condition.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->finished = true;
+        }
+        this->condition.notify_all();
+    }
+};
+
+//! @}
+
+#endif
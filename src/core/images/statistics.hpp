@@ -0,0 +1,212 @@
+#ifndef STATISTICS_HPP_
+#define STATISTICS_HPP_
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Size of the edge of the cubic bricks of an OccupancyMap, and of the tiles of a slice skipped by ImageStatistics
+#define OCCUPANCY_BRICK_SIZE 16
+
+//! \addtogroup img
+//! @{
+
+//! @brief Statistics of the values of an image, accumulated slice by slice while the image is read.
+//!
+//! This allows to get the min/max values, the histogram and the non-zero bounding box of an image without any
+//! additional pass over its data. When slices are read by several threads, each thread fills its own
+//! ImageStatistics and they are combined with merge().
+struct ImageStatistics {
+
+    //! @brief Smallest non-zero value, as 0 is the background.
+    uint16_t minValue;
+    uint16_t maxValue;
+
+    //! @brief Number of voxels for each value, indexed by the value.
+    std::vector<uint64_t> histogram;
+
+    //! @brief Bounding box of the non-zero voxels, bbMax excluded. If there is no such voxel, bbMin > bbMax.
+    glm::vec3 bbMin;
+    glm::vec3 bbMax;
+
+    ImageStatistics():
+        minValue(std::numeric_limits<uint16_t>::max()), maxValue(std::numeric_limits<uint16_t>::min()),
+        bbMin(std::numeric_limits<float>::max()), bbMax(std::numeric_limits<float>::lowest()) {}
+
+    //! @brief Add a width * height slice, sliceIdx is its z coordinate.
+    //! @param nbChannels Number of interleaved channels of the slice, only the channel channel is added.
+    //! @param occupiedTiles If given, the OCCUPANCY_BRICK_SIZE * OCCUPANCY_BRICK_SIZE tiles of the slice set to 0 only have zeros,
+    //! e.g. the ones found by OccupancyMap::addSlice(), and their values are counted without being read.
+    template <typename data_t>
+    void addSlice(int sliceIdx, const std::vector<data_t>& slice, int width, int height, int nbChannels = 1, int channel = 0, const std::vector<uint8_t> * occupiedTiles = nullptr) {
+        const std::size_t nbValues = std::size_t(1) << (sizeof(data_t) * 8);
+        if(this->histogram.size() < nbValues)
+            this->histogram.resize(nbValues, 0);
+        uint64_t * counts = this->histogram.data();
+
+        int sliceMinX = width;
+        int sliceMaxX = -1;
+        int sliceMinY = height;
+        int sliceMaxY = -1;
+        data_t sliceMin = std::numeric_limits<data_t>::max();
+        data_t sliceMax = std::numeric_limits<data_t>::min();
+        const int nbTilesX = (width + OCCUPANCY_BRICK_SIZE - 1) / OCCUPANCY_BRICK_SIZE;
+        const int segmentSize = occupiedTiles ? OCCUPANCY_BRICK_SIZE : width;
+        for(int y = 0; y < height; ++y) {
+            const data_t * row = slice.data() + static_cast<std::size_t>(y) * width * nbChannels + channel;
+            const uint8_t * tiles = occupiedTiles ? occupiedTiles->data() + static_cast<std::size_t>(y / OCCUPANCY_BRICK_SIZE) * nbTilesX : nullptr;
+            int rowMinX = width;
+            int rowMaxX = -1;
+            for(int begin = 0; begin < width; begin += segmentSize) {
+                const int end = std::min(width, begin + segmentSize);
+                if(tiles && !tiles[begin / OCCUPANCY_BRICK_SIZE]) {
+                    counts[0] += end - begin;
+                    continue;
+                }
+                for(int x = begin; x < end; ++x) {
+                    const data_t value = row[x * nbChannels];
+                    ++counts[value];
+                    sliceMax = std::max(sliceMax, value);
+                    if(value > 0) {
+                        sliceMin = std::min(sliceMin, value);
+                        rowMinX = std::min(rowMinX, x);
+                        rowMaxX = x;
+                    }
+                }
+            }
+            if(rowMaxX >= 0) {
+                sliceMinX = std::min(sliceMinX, rowMinX);
+                sliceMaxX = std::max(sliceMaxX, rowMaxX);
+                sliceMinY = std::min(sliceMinY, y);
+                sliceMaxY = y;
+            }
+        }
+
+        this->maxValue = std::max<uint16_t>(this->maxValue, sliceMax);
+        if(sliceMaxX >= 0) {
+            this->minValue = std::min<uint16_t>(this->minValue, sliceMin);
+            this->bbMin = glm::min(this->bbMin, glm::vec3(sliceMinX, sliceMinY, sliceIdx));
+            this->bbMax = glm::max(this->bbMax, glm::vec3(sliceMaxX + 1, sliceMaxY + 1, sliceIdx + 1));
+        }
+    }
+
+    void merge(const ImageStatistics& other) {
+        this->minValue = std::min(this->minValue, other.minValue);
+        this->maxValue = std::max(this->maxValue, other.maxValue);
+        if(this->histogram.size() < other.histogram.size())
+            this->histogram.resize(other.histogram.size(), 0);
+        for(std::size_t i = 0; i < other.histogram.size(); ++i)
+            this->histogram[i] += other.histogram[i];
+        this->bbMin = glm::min(this->bbMin, other.bbMin);
+        this->bbMax = glm::max(this->bbMax, other.bbMax);
+    }
+
+    bool hasNonZeroValues() const {
+        return this->bbMin[0] <= this->bbMax[0];
+    }
+};
+
+//! @brief Bricks of OCCUPANCY_BRICK_SIZE voxels of an image that have at least one value above a threshold, found slice by slice
+//! while the image is read, as ImageStatistics.
+//!
+//! Most of the volume of cleared tissue images is background: the sampling, the export and the upload of the grids use this map
+//! to skip the empty bricks instead of reading their voxels. Several threads can add slices at once, as a brick is only ever marked
+//! as occupied.
+struct OccupancyMap {
+    glm::ivec3 size;
+    glm::ivec3 nbBricks;
+    //! @brief The values up to threshold are background. With a non-zero threshold, the background skipped is read as 0.
+    uint16_t threshold;
+    //! @brief 1 for the occupied bricks, x first, then y, then z.
+    std::vector<uint8_t> occupied;
+
+    OccupancyMap(): size(0, 0, 0), nbBricks(0, 0, 0), threshold(0) {}
+
+    //! @brief Map of an image of the given size without any occupied brick.
+    OccupancyMap(const glm::ivec3& size, uint16_t threshold = 0):
+        size(size), nbBricks((size + OCCUPANCY_BRICK_SIZE - 1) / OCCUPANCY_BRICK_SIZE), threshold(threshold),
+        occupied(static_cast<std::size_t>(this->nbBricks.x) * this->nbBricks.y * this->nbBricks.z, 0) {}
+
+    //! @return false if the map is unknown, the whole image must then be read.
+    bool isValid() const {
+        return !this->occupied.empty();
+    }
+
+    //! @brief Mark the bricks of the slice sliceIdx which have values above the threshold, on any of the nbChannels interleaved channels.
+    //! @param occupiedTiles Set to the OCCUPANCY_BRICK_SIZE * OCCUPANCY_BRICK_SIZE tiles of the slice with such values, x first.
+    template <typename data_t>
+    void addSlice(int sliceIdx, const std::vector<data_t>& slice, int nbChannels, std::vector<uint8_t>& occupiedTiles) {
+        occupiedTiles.assign(static_cast<std::size_t>(this->nbBricks.x) * this->nbBricks.y, 0);
+        const int rowSize = this->size.x * nbChannels;
+        for(int y = 0; y < this->size.y; ++y) {
+            const data_t * row = slice.data() + static_cast<std::size_t>(y) * rowSize;
+            uint8_t * tiles = occupiedTiles.data() + static_cast<std::size_t>(y / OCCUPANCY_BRICK_SIZE) * this->nbBricks.x;
+            for(int brickX = 0; brickX < this->nbBricks.x; ++brickX) {
+                if(tiles[brickX])
+                    continue;
+                // The max is computed without branches, so that it is vectorized
+                const data_t * end = row + std::min(rowSize, (brickX + 1) * OCCUPANCY_BRICK_SIZE * nbChannels);
+                data_t maxValue = 0;
+                for(const data_t * value = row + brickX * OCCUPANCY_BRICK_SIZE * nbChannels; value < end; ++value)
+                    maxValue = std::max(maxValue, *value);
+                tiles[brickX] = maxValue > this->threshold;
+            }
+        }
+        uint8_t * bricks = this->occupied.data() + static_cast<std::size_t>(sliceIdx / OCCUPANCY_BRICK_SIZE) * this->nbBricks.x * this->nbBricks.y;
+        for(std::size_t i = 0; i < occupiedTiles.size(); ++i) {
+            if(occupiedTiles[i]) {
+                #pragma omp atomic write
+                bricks[i] = 1;
+            }
+        }
+    }
+
+    //! @brief Mark the bricks of the box [min, max], max included, as occupied.
+    void setOccupied(const glm::ivec3& min, const glm::ivec3& max) {
+        for(int z = min.z / OCCUPANCY_BRICK_SIZE; z <= max.z / OCCUPANCY_BRICK_SIZE; ++z) {
+            for(int y = min.y / OCCUPANCY_BRICK_SIZE; y <= max.y / OCCUPANCY_BRICK_SIZE; ++y) {
+                for(int x = min.x / OCCUPANCY_BRICK_SIZE; x <= max.x / OCCUPANCY_BRICK_SIZE; ++x) {
+                    #pragma omp atomic write
+                    this->occupied[this->getBrickIdx(x, y, z)] = 1;
+                }
+            }
+        }
+    }
+
+    //! @brief True if all the voxels of the box [min, max], max included, are background. The voxels outside of the image are background.
+    bool isEmpty(glm::ivec3 min, glm::ivec3 max) const {
+        for(int i = 0; i < 3; ++i) {
+            min[i] = std::max(min[i], 0);
+            max[i] = std::min(max[i], this->size[i] - 1);
+            if(min[i] > max[i])
+                return true;
+        }
+        for(int z = min.z / OCCUPANCY_BRICK_SIZE; z <= max.z / OCCUPANCY_BRICK_SIZE; ++z) {
+            for(int y = min.y / OCCUPANCY_BRICK_SIZE; y <= max.y / OCCUPANCY_BRICK_SIZE; ++y) {
+                for(int x = min.x / OCCUPANCY_BRICK_SIZE; x <= max.x / OCCUPANCY_BRICK_SIZE; ++x) {
+                    if(this->occupied[this->getBrickIdx(x, y, z)])
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    //! @brief Ratio of the bricks that are occupied.
+    float getOccupancy() const {
+        if(this->occupied.empty())
+            return 1.f;
+        return static_cast<float>(std::count(this->occupied.begin(), this->occupied.end(), 1)) / this->occupied.size();
+    }
+
+private:
+    std::size_t getBrickIdx(int x, int y, int z) const {
+        return (static_cast<std::size_t>(z) * this->nbBricks.y + y) * this->nbBricks.x + x;
+    }
+};
+
+//! @}
+
+#endif
@@ -102,7 +102,10 @@ namespace Image {
 	/// @brief A simple tagging system, allowing for explicit concrete function calls from a template interface.
 	template <typename restict_t>
 	struct tag
-	{};
+	{
+		/// @brief The tagged type, to be retrieved from a generic lambda with `typename decltype(t)::type`
+		using type = restict_t;
+	};
 
 	/// @brief Simple extraction operator to print the type of the tag to something like std::cout, std::cerr ...
 	template <typename tag_t>
@@ -51,7 +51,7 @@ void FileChooser::click() {
     switch(this->type) {
         case FileChooserType::SELECT:
             if(this->format == FileChooserFormat::TIFF)
-                filename = QFileDialog::getOpenFileName(nullptr, "Open TIFF images", QDir::currentPath(), "TIFF files (*.tiff *.tif)", 0, QFileDialog::DontUseNativeDialog);
+                filename = QFileDialog::getOpenFileName(nullptr, "Open images", QDir::currentPath(), "Images (*.tiff *.tif *.dim *.ima *.nii *.nii.gz *.bvol);;TIFF files (*.tiff *.tif);;BrainVISA files (*.dim *.ima);;NIfTI files (*.nii *.nii.gz);;Bricked images (*.bvol)", 0, QFileDialog::DontUseNativeDialog);
             else if(this->format == FileChooserFormat::MESH)
                 filename = QFileDialog::getOpenFileName(nullptr, "Open mesh file", QDir::currentPath(), "MESH files (*.mesh)", 0, QFileDialog::DontUseNativeDialog);
             else
@@ -65,6 +65,8 @@ void FileChooser::click() {
                 filename = QFileDialog::getSaveFileName(nullptr, "Select the mesh to save", QDir::currentPath(), tr("MESH Files (*.mesh)"), 0, QFileDialog::DontUseNativeDialog);
             else if(this->format == FileChooserFormat::PATH)
                 filename = QFileDialog::getExistingDirectory(nullptr, "Select the directory to save", QDir::currentPath(), QFileDialog::DontUseNativeDialog);
+            else if(this->format == FileChooserFormat::BRICKED)
+                filename = QFileDialog::getSaveFileName(nullptr, "Select the image to save", QDir::currentPath(), tr("Bricked images (*.bvol)"), 0, QFileDialog::DontUseNativeDialog);
             else
                 filename = QFileDialog::getSaveFileName(nullptr, "Select the mesh to save", QDir::currentPath(), tr("OFF Files (*.off)"), 0, QFileDialog::DontUseNativeDialog);
             break;
@@ -34,7 +34,8 @@ enum class FileChooserFormat {
     TIFF,
     MESH,
     PATH,
-    OFF
+    OFF,
+    BRICKED
 };
 
 class FileChooser : public QPushButton {
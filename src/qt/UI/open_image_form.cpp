@@ -10,7 +10,7 @@ void OpenImageForm::update(Scene * scene) {
 void OpenImageForm::connect(Scene * scene) {
     QObject::connect(this->fileChoosers["Image choose"], &FileChooser::fileSelected, [this](){
             this->buttons["Load"]->setEnabled(true);
-            //this->sections["Image subregion"].first->setEnabled(true);// This functionnality isn't available yet
+            this->sections["Image subregion"].first->setEnabled(true);
             this->sections["Mesh"].first->show();
             this->sections["Cage"].first->show();
 
@@ -20,15 +20,38 @@ void OpenImageForm::connect(Scene * scene) {
             this->prefillFields({this->fileChoosers["Image choose"]->filename.toStdString()});
             });
 
+    // The region of interest of a grid already loaded is grown instead of opening the image again, see Scene::expandGridROI()
+    QObject::connect(this->lineEdits["Name"], &QLineEdit::textChanged, [this, scene](){
+            const bool isLoadedGrid = scene->isGrid(this->getGridName());
+            this->buttons["Expand"]->setEnabled(isLoadedGrid);
+            if(isLoadedGrid)
+                this->sections["Image subregion"].first->setEnabled(true);
+            });
+
+    QObject::connect(this->buttons["Expand"], &QPushButton::clicked, [this, scene](){
+        const std::pair<glm::vec3, glm::vec3> roi = this->getROI();
+        if(!scene->expandGridROI(this->getGridName(), roi.first, roi.second)) {
+            std::cout << "WARNING: the region of [" << this->getGridName() << "] already includes the subregion" << std::endl;
+            return;
+        }
+        this->hide();
+        Q_EMIT loaded();
+    });
+
     QObject::connect(this->fileChoosers["Mesh choose"], &FileChooser::fileSelected, [this](){
             this->useTetMesh = true;
             });
 
     QObject::connect(this->buttons["Load"], &QPushButton::clicked, [this, scene](){
+        bool opened = false;
         if(this->useTetMesh) {
-            scene->openGrid(this->getGridName(), this->getImgFilenames(), this->getSubsample(), this->getVoxelSize(), this->getTetmeshFilename());
+            opened = scene->openGrid(this->getGridName(), this->getImgFilenames(), this->getSubsample(), this->getVoxelSize(), this->getTetmeshFilename(), this->getSubsampleMethod(), this->getROI(), this->getMemoryBudget(), this->getUseIndexFile());
         } else {
-            scene->openGrid(this->getGridName(), this->getImgFilenames(), this->getSubsample(), this->getVoxelSize(), this->getSizeTetmesh());
+            opened = scene->openGrid(this->getGridName(), this->getImgFilenames(), this->getSubsample(), this->getVoxelSize(), this->getSizeTetmesh(), this->getSubsampleMethod(), this->getROI(), this->getMemoryBudget(), this->getUseIndexFile());
+        }
+        if(!opened) {
+            QMessageBox::critical(this, "Error", "The image cannot be read.");
+            return;
         }
         bool useCage = !this->fileChoosers["Cage choose"]->filename.isEmpty();
         if(useCage) {
@@ -8,6 +8,7 @@
 #include "glm/glm.hpp"
 #include "form.hpp"
 #include "../../core/images/image.hpp"
+#include "../../core/geometry/grid.hpp"
 
 
 class OpenImageForm : public Form {
@@ -41,6 +42,10 @@ public slots:
 
         this->addWithLabel(WidgetType::SPIN_BOX, "Subsample", "Subsample: ");
 
+        this->addWithLabel(WidgetType::SPIN_BOX, "MemoryBudget", "Memory budget (MB, 0 for no limit): ");
+
+        this->addWithLabel(WidgetType::CHECK_BOX, "IndexFile", "Use index file: ");
+
         /***/
 
         this->add(WidgetType::SECTION_CHECKABLE, "Image subregion");
@@ -63,6 +68,11 @@ public slots:
         this->add(WidgetType::SPIN_BOX, "BBMaxY");
         this->add(WidgetType::SPIN_BOX, "BBMaxZ");
 
+        this->addAllNextWidgetsToDefaultGroup();
+        this->addAllNextWidgetsToSection("Image subregion");
+
+        this->add(WidgetType::BUTTON, "Expand", "Expand the loaded grid");
+
         /***/
 
         this->addAllNextWidgetsToSection("Image");
@@ -174,7 +184,6 @@ public slots:
         this->resetValues();
 
         //this->sections["Image subsample"].first->hide();
-        this->sections["Image subregion"].first->hide();
         //this->labels["GroupVoxelSize"]->hide();
         //this->doubleSpinBoxes["SizeVoxelX"]->hide();
         //this->doubleSpinBoxes["SizeVoxelY"]->hide();
@@ -197,6 +206,12 @@ public slots:
         this->spinBoxes["Subsample"]->setValue(1);
         this->spinBoxes["Subsample"]->setMinimum(1);
 
+        this->spinBoxes["MemoryBudget"]->setMinimum(0);
+        this->spinBoxes["MemoryBudget"]->setMaximum(std::numeric_limits<int>::max());
+        this->spinBoxes["MemoryBudget"]->setValue(0);
+
+        this->checkBoxes["IndexFile"]->setChecked(false);
+
         //this->spinBoxes["NbTetX"]->setValue(5);
         //this->spinBoxes["NbTetX"]->setMinimum(1);
         //this->spinBoxes["NbTetY"]->setValue(5);
@@ -217,7 +232,19 @@ public slots:
         this->sections["Mesh"].first->setChecked(false);
         this->sections["Cage"].first->setChecked(false);
 
+        // The region is given in voxels of the original image, the default max covers any image as it is clamped to the image
+        for(const char * bound : {"BBMinX", "BBMinY", "BBMinZ", "BBMaxX", "BBMaxY", "BBMaxZ"}) {
+            this->spinBoxes[bound]->setMinimum(0);
+            this->spinBoxes[bound]->setMaximum(std::numeric_limits<int>::max());
+        }
+        for(const char * bound : {"BBMinX", "BBMinY", "BBMinZ"})
+            this->spinBoxes[bound]->setValue(0);
+        for(const char * bound : {"BBMaxX", "BBMaxY", "BBMaxZ"})
+            this->spinBoxes[bound]->setValue(std::numeric_limits<int>::max());
+
+        this->sections["Image subregion"].first->setChecked(false);
         this->sections["Image subregion"].first->setEnabled(false);
+        this->buttons["Expand"]->setEnabled(false);
 
         this->buttons["Load"]->setEnabled(false);
     }
@@ -253,6 +280,29 @@ public slots:
         return this->spinBoxes["Subsample"]->value();
     }
 
+    // Labels of a segmented image cannot be averaged
+    SubsampleMethod getSubsampleMethod() {
+        return this->checkBoxes["Segmented"]->isChecked() ? SubsampleMethod::Skip : SubsampleMethod::Mean;
+    }
+
+    // Only the region of interest is loaded, which allows to open parts of huge images at full resolution
+    std::pair<glm::vec3, glm::vec3> getROI() {
+        if(!this->sections["Image subregion"].first->isChecked())
+            return Sampler::getWholeImageROI();
+        return {glm::vec3(this->spinBoxes["BBMinX"]->value(), this->spinBoxes["BBMinY"]->value(), this->spinBoxes["BBMinZ"]->value()),
+                glm::vec3(this->spinBoxes["BBMaxX"]->value(), this->spinBoxes["BBMaxY"]->value(), this->spinBoxes["BBMaxZ"]->value())};
+    }
+
+    // Images larger than the budget are read on demand, which allows to open them at full resolution
+    std::size_t getMemoryBudget() {
+        return static_cast<std::size_t>(this->spinBoxes["MemoryBudget"]->value()) * 1024 * 1024;
+    }
+
+    // The metadata of a TIFF image are then cached next to it, which makes the next openings faster
+    bool getUseIndexFile() {
+        return this->checkBoxes["IndexFile"]->isChecked();
+    }
+
     glm::vec3 getVoxelSize() {
         return glm::vec3(float(this->doubleSpinBoxes["SizeVoxelX"]->value())*float(this->getSubsample()),
                          float(this->doubleSpinBoxes["SizeVoxelY"]->value())*float(this->getSubsample()),
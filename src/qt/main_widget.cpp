@@ -56,9 +56,11 @@ void MainWidget::setupWidgets() {
     this->fileMenu->addAction(this->actionManager->getAction("SaveCage"));
     this->fileMenu->addAction(this->actionManager->getAction("SaveAsCage"));
     this->fileMenu->addAction(this->actionManager->getAction("SaveImage"));
+    this->fileMenu->addAction(this->actionManager->getAction("SaveBrickedImage"));
     //this->fileMenu->addAction(this->actionManager->getAction("SaveImageColormap"));
     this->actionManager->getAction("SaveImage")->setDisabled(true);
     this->actionManager->getAction("SaveImageColormap")->setDisabled(true);
+    this->actionManager->getAction("SaveBrickedImage")->setDisabled(true);
 
     this->editMenu = this->menuBar()->addMenu("&Edit");
     this->editMenu->addAction(this->actionManager->getAction("ApplyCage"));
@@ -419,6 +421,7 @@ void MainWidget::setupActions() {
             this->actionManager->getAction("OpenImage")->setDisabled(false);
             this->actionManager->getAction("SaveImage")->setDisabled(true);
             this->actionManager->getAction("SaveImageColormap")->setDisabled(true);
+            this->actionManager->getAction("SaveBrickedImage")->setDisabled(true);
             this->actionManager->getAction("ToggleDisplayMultiView")->setDisabled(true);
             this->actionManager->getAction("Transform")->setDisabled(true);
             this->actionManager->getAction("Boundaries")->setVisible(false);
@@ -463,6 +466,21 @@ void MainWidget::setupActions() {
             delete fileChooser;
     });
 
+    this->actionManager->createQActionButton("SaveBrickedImage", "Save bricked copy...", "", "Save the original image in the bricked format, faster to open", "save");
+    QObject::connect(this->actionManager->getAction("SaveBrickedImage"), &QAction::triggered, [this](){
+            FileChooser * fileChooser = new FileChooser("File", FileChooserType::SAVE, FileChooserFormat::BRICKED);
+            fileChooser->click();
+
+            std::string gridName = this->combo_mesh->itemText(this->combo_mesh->currentIndex()).toStdString();
+            if(!fileChooser->filename.isEmpty()) {
+                if(scene->isCage(gridName)) {
+                    gridName = scene->grids_name[scene->getGridIdxLinkToCage(gridName)];
+                }
+                this->scene->writeBrickedImage(fileChooser->filename.toStdString(), gridName);
+            }
+            delete fileChooser;
+    });
+
     this->actionManager->createMenuButton("SaveMenu", "Save", "Save the current cage", "saveDeformedImage", {"SaveImage", "SaveAsImage", "-", "SaveCage", "SaveAsCage"});
 
     this->actionManager->createQActionButton("ApplyCage", "Apply cage...", "", "Apply a cage on a previously loaded cage", "");
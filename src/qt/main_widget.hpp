@@ -143,6 +143,7 @@ public slots:
         this->combo_mesh->insertItem(this->combo_mesh->count(), QString(name.c_str()));
         this->actionManager->getAction("SaveImage")->setDisabled(false);
         this->actionManager->getAction("SaveImageColormap")->setDisabled(false);
+        this->actionManager->getAction("SaveBrickedImage")->setDisabled(false);
         if(this->scene->hasTwoOrMoreGrids()) {
             this->actionManager->getAction("ToggleDisplayMultiView")->setDisabled(false);
             this->actionManager->getAction("Transform")->setDisabled(false);
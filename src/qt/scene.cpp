@@ -72,6 +72,8 @@ Scene::Scene() {
 
     //std::cerr << "Allocating " << +std::numeric_limits<GridGLView::data_t>::max() << " elements for vis ...\n";
 
+    this->prefetchDepth = 4;
+
     this->shouldUpdateUserColorScales = false;
     this->needUpdateMinMaxDisplayValues		  = false;
 
@@ -208,7 +210,13 @@ void Scene::createBuffers() {
 
 std::pair<uint16_t, uint16_t> Scene::sendGridValuesToGPU(int gridIdx) {
 
-    glm::vec<4, std::size_t, glm::defaultp> dimensions{this->grids[gridIdx]->getResolution(), 2};
+    Sampler& sampler = this->grids[gridIdx]->sampler;
+    // The texture is uploaded from the finest level of the pyramid that fits in the GPU
+    // As the texture coordinates are normalized, the shaders do not depend on the resolution of the texture
+    const int level = (this->maximumTextureSize > 0) ? sampler.getLevelForResolution(glm::vec3(this->maximumTextureSize)) : 0;
+    if(level > 0)
+        std::cout << "INFO: grid too large to fit in the GPU, level [" << level << "] of the pyramid is used" << std::endl;
+    glm::vec<4, std::size_t, glm::defaultp> dimensions{sampler.getLevelDimension(level), 2};
     TextureUpload _gridTex{};
     _gridTex.minmag.x  = GL_NEAREST;
     _gridTex.minmag.y  = GL_NEAREST;
@@ -232,77 +240,118 @@ std::pair<uint16_t, uint16_t> Scene::sendGridValuesToGPU(int gridIdx) {
     } else {
         _gridTex.swizzle.a = GL_ONE;
     }
+    // 8 bits grids are uploaded as 8 bits textures, which halves the memory used on the GPU and the upload time
+    const bool use8Bits = this->grids[gridIdx]->sampler.getBitDepth() == 8;
     _gridTex.alignment.x = 1;
-    _gridTex.alignment.y = 2;
+    _gridTex.alignment.y = use8Bits ? 1 : 2;
     switch (dimensions.a) {
         case 1:
             _gridTex.format			= GL_RED_INTEGER;
-            _gridTex.internalFormat = GL_R16UI;
+            _gridTex.internalFormat = use8Bits ? GL_R8UI : GL_R16UI;
             break;
         case 2:
             _gridTex.format			= GL_RG_INTEGER;
-            _gridTex.internalFormat = GL_RG16UI;
+            _gridTex.internalFormat = use8Bits ? GL_RG8UI : GL_RG16UI;
             break;
         case 3:
             _gridTex.format			= GL_RGB_INTEGER;
-            _gridTex.internalFormat = GL_RGB16UI;
+            _gridTex.internalFormat = use8Bits ? GL_RGB8UI : GL_RGB16UI;
             break;
         case 4:
             _gridTex.format			= GL_RGBA_INTEGER;
-            _gridTex.internalFormat = GL_RGBA16UI;
+            _gridTex.internalFormat = use8Bits ? GL_RGBA8UI : GL_RGBA16UI;
             break;
     }
-    _gridTex.type = GL_UNSIGNED_SHORT;
+    _gridTex.type = use8Bits ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
     std::cerr << "Made the upload texture struct.\n";
 
     _gridTex.size.x = dimensions.x;
     _gridTex.size.y = dimensions.y;
     _gridTex.size.z = dimensions.z;
 
-    std::vector<std::uint16_t> slices;
     glDeleteTextures(1, &this->grids[gridIdx]->gridTexture);
     this->grids[gridIdx]->gridTexture = this->newAPI_uploadTexture3D_allocateonly(_gridTex);
 
-    int nbSlice = this->grids[gridIdx]->getResolution()[2];
+    int nbSlice = dimensions.z;
 
     //TODO: this computation do not belong here
     uint16_t max = std::numeric_limits<uint16_t>::min();
     uint16_t min = std::numeric_limits<uint16_t>::max();
+    // Skip the min/max computation if it is known from the sampler statistics or the image index
+    const bool minMaxKnown = this->grids[gridIdx]->sampler.getMinMax(min, max);
 
     dimensions[0] = dimensions[0] * dimensions[3];// Because we have "a" value
 
     bool addArticialBoundaries = false;
 
-    int sliceI = 0;
-    for (std::size_t s = 0; s < nbSlice; ++s) {
-        this->grids[gridIdx]->getGridSlice(s, slices, dimensions.a);
-        if(addArticialBoundaries) {
-            if(s == 0 || s == nbSlice-1){
-                std::fill(slices.begin(), slices.end(), 0);
+    // Slices are read with the bit depth of the texture
+    auto uploadSlices = [&](auto typeTag) {
+        using data_t = typename decltype(typeTag)::type;
+        std::vector<data_t> slices;
+        std::vector<data_t> levelSlice;
+
+        // Without cache, slices are read ahead in a background thread while the current one is uploaded
+        std::unique_ptr<ImageReader> prefetchReader;
+        std::unique_ptr<SlicePrefetcher<data_t>> prefetcher;
+        if(!sampler.useCache) {
+            prefetchReader = std::make_unique<ImageReader>(*sampler.image);
+            prefetcher = std::make_unique<SlicePrefetcher<data_t>>([&](int s, std::vector<data_t>& slice) {
+                sampler.getGridSlice(s, slice, dimensions.a, prefetchReader.get());
+            }, 0, nbSlice, this->prefetchDepth);
+        }
+
+        int sliceI = 0;
+        for (std::size_t s = 0; s < nbSlice; ++s) {
+            if(prefetcher) {
+                prefetcher->getNextSlice(slices);
             } else {
-                for(int i = 0; i < dimensions.x; ++i) {
-                    slices[i] = 0;
-                    slices[i+(dimensions.x*(dimensions.y-1))] = 0;
+                // The values are already in memory, the image file is not read again
+                // The channels of the texture are the ones of the grid, the last one is duplicated if the grid has less channels
+                levelSlice.clear();
+                sampler.getLevelSlice(level, s, levelSlice);
+                const std::size_t nbGridChannels = sampler.nbChannels;
+                const std::size_t nbVoxels = levelSlice.size() / nbGridChannels;
+                slices.resize(nbVoxels * dimensions.a);
+                for(std::size_t i = 0; i < nbVoxels; ++i)
+                    for(std::size_t c = 0; c < dimensions.a; ++c)
+                        slices[i * dimensions.a + c] = levelSlice[i * nbGridChannels + std::min(c, nbGridChannels - 1)];
+            }
+            if(addArticialBoundaries) {
+                if(s == 0 || s == nbSlice-1){
+                    std::fill(slices.begin(), slices.end(), 0);
+                } else {
+                    for(int i = 0; i < dimensions.x; ++i) {
+                        slices[i] = 0;
+                        slices[i+(dimensions.x*(dimensions.y-1))] = 0;
+                    }
+                    for(int i = 0; i < dimensions.y; ++i) {
+                        slices[i*dimensions.x] = 0;
+                        slices[i*dimensions.x+1] = 0;
+                        slices[i*dimensions.x+(dimensions.x-1)] = 0;
+                        slices[i*dimensions.x+(dimensions.x-2)] = 0;
+                    }
                 }
-                for(int i = 0; i < dimensions.y; ++i) {
-                    slices[i*dimensions.x] = 0;
-                    slices[i*dimensions.x+1] = 0;
-                    slices[i*dimensions.x+(dimensions.x-1)] = 0;
-                    slices[i*dimensions.x+(dimensions.x-2)] = 0;
+            }
+            this->newAPI_uploadTexture3D(this->grids[gridIdx]->gridTexture, _gridTex, sliceI, slices);
+
+            if(!minMaxKnown) {
+                max = std::max<uint16_t>(max, *std::max_element(slices.begin(), slices.end()));
+                //min = std::min(min, *std::min_element(slices.begin(), slices.end()));
+                for(data_t& val : slices) {
+                    if(val > 0 && val < min)
+                        min = val;
                 }
             }
+            slices.clear();
+            sliceI++;
         }
-        this->newAPI_uploadTexture3D(this->grids[gridIdx]->gridTexture, _gridTex, sliceI, slices);
-
-        max = std::max(max, *std::max_element(slices.begin(), slices.end()));
-        //min = std::min(min, *std::min_element(slices.begin(), slices.end()));
-        for(uint16_t& val : slices) {
-            if(val > 0 && val < min)
-                min = val;
-        }
-        slices.clear();
-        sliceI++;
-    }
+    };
+    if(use8Bits)
+        uploadSlices(Image::tag<std::uint8_t>());
+    else
+        uploadSlices(Image::tag<std::uint16_t>());
+    // The values of a coarser level are means under SubsampleMethod::Mean, their range is narrower than the one of the grid
+    sampler.setMinMax(min, max, minMaxKnown || level == 0);
     this->needUpdateMinMaxDisplayValues = true;
     return std::make_pair(min, max);
 }
@@ -318,8 +367,6 @@ void Scene::addGrid() {
 
     uint16_t min = min_max.first;
     uint16_t max = min_max.second;
-    gridView->sampler.image->minValue = min;
-    gridView->sampler.image->maxValue = max;
 
     if(this->activeGrid == 0) {
         QColor r = Qt::GlobalColor::red;
@@ -537,7 +584,8 @@ GLuint Scene::newAPI_uploadTexture3D_allocateonly(const TextureUpload& tex) {
     return texHandle;
 }
 
-GLuint Scene::newAPI_uploadTexture3D(const GLuint texHandle, const TextureUpload& tex, std::size_t s, std::vector<std::uint16_t>& data) {
+template<typename DataType>
+GLuint Scene::newAPI_uploadTexture3D(const GLuint texHandle, const TextureUpload& tex, std::size_t s, std::vector<DataType>& data) {
     if (this->context != nullptr) {
         if (this->context->isValid() == false) {
             throw std::runtime_error("No associated valid context");
@@ -1274,21 +1322,48 @@ bool Scene::openCage(const std::string& name, const std::string& filename, BaseM
     return true;
 }
 
-bool Scene::openGrid(const std::string& name, const std::vector<std::string>& imgFilenames, const int subsample, const glm::vec3& sizeVoxel, const glm::vec3& nbCubeGridTransferMesh) {
+bool Scene::openGrid(const std::string& name, const std::vector<std::string>& imgFilenames, const int subsample, const glm::vec3& sizeVoxel, const glm::vec3& nbCubeGridTransferMesh, SubsampleMethod subsampleMethod, const std::pair<glm::vec3, glm::vec3>& roi, std::size_t memoryBudget, bool useIndexFile) {
     int autofitSubsample = this->autofitSubsample(subsample, imgFilenames);
-    Grid * newGrid = new Grid(imgFilenames, autofitSubsample, sizeVoxel, nbCubeGridTransferMesh);
+    Grid * newGrid = nullptr;
+    try {
+        newGrid = new Grid(imgFilenames, autofitSubsample, sizeVoxel, nbCubeGridTransferMesh, subsampleMethod, roi, memoryBudget, useIndexFile);
+    } catch(const std::runtime_error& error) {
+        std::cout << error.what() << std::endl;
+        return false;
+    }
     this->addGridToScene(name, newGrid);
     return true;
 }
 
-bool Scene::openGrid(const std::string& name, const std::vector<std::string>& imgFilenames, const int subsample, const glm::vec3& sizeVoxel, const std::string& transferMeshFileName) {
+bool Scene::openGrid(const std::string& name, const std::vector<std::string>& imgFilenames, const int subsample, const glm::vec3& sizeVoxel, const std::string& transferMeshFileName, SubsampleMethod subsampleMethod, const std::pair<glm::vec3, glm::vec3>& roi, std::size_t memoryBudget, bool useIndexFile) {
     int autofitSubsample = this->autofitSubsample(subsample, imgFilenames);
     //TODO: sizeVoxel isn't take into account with loading a custom transferMesh
-    Grid * newGrid = new Grid(imgFilenames, autofitSubsample, sizeVoxel, transferMeshFileName);
+    Grid * newGrid = nullptr;
+    try {
+        newGrid = new Grid(imgFilenames, autofitSubsample, sizeVoxel, transferMeshFileName, subsampleMethod, roi, memoryBudget, useIndexFile);
+    } catch(const std::runtime_error& error) {
+        std::cout << error.what() << std::endl;
+        return false;
+    }
     this->addGridToScene(name, newGrid);
     return true;
 }
 
+bool Scene::expandGridROI(const std::string& name, const glm::vec3& roiMin, const glm::vec3& roiMax) {
+    int gridIdx = this->getGridIdx(name);
+    if(gridIdx == -1)
+        return false;
+    Grid * grid = this->grids[gridIdx];
+    if(!grid->expandROI({roiMin, roiMax}))
+        return false;
+
+    this->sendGridValuesToGPU(gridIdx);
+    grid->sendTetmeshToGPU(Grid::InfoToSend(Grid::InfoToSend::VERTICES | Grid::InfoToSend::NORMALS | Grid::InfoToSend::TEXCOORD | Grid::InfoToSend::NEIGHBORS));
+    this->updateSceneCenter();
+    Q_EMIT meshMoved();
+    return true;
+}
+
 void Scene::addGridToScene(const std::string& name, Grid * newGrid) {
     Grid * gridView = newGrid;
     this->grids.push_back(gridView);
@@ -1939,14 +2014,40 @@ void Scene::writeDeformedImageTemplated(const std::string& filename, const std::
         }
     }
 
-    int cacheMaxNb = std::floor(fromGrid->sampler.image->tiffImageReader->imgResolution.z / float(cacheSize));
+    const glm::vec3 imgResolution = fromGrid->sampler.image->imgResolution;
+    int cacheMaxNb = std::floor(imgResolution.z / float(cacheSize));
     std::map<int, std::vector<DataType>> cache;
+    // A paged cache already keeps the bricks of the image that were used recently, and can be read by all the threads at once.
+    // Its values are only exported as they are when the exported type is the one of the cache.
+    const bool usePagedCache = fromGrid->sampler.usePagedCache && (dataType & Image::ImageDataType::Unsigned) && bit == fromGrid->sampler.getBitDepth();
+    // The voxels of the image are the ones of the sampler only at full resolution and with their own bit depth
+    const bool skipBackground = fromGrid->sampler.resolutionRatio == glm::vec3(1., 1., 1.) && (dataType & Image::ImageDataType::Unsigned) && bit <= 16;
+
+    // The slices are read through ImageReader whatever the format of the image, with at most 16 bits per value as in the sampler
+    using read_t = typename std::conditional<sizeof(DataType) == 1, uint8_t, uint16_t>::type;
+    auto readSlice = [&](const ImageReader& reader, int sliceIdx, std::vector<DataType>& slice) {
+        if constexpr (std::is_same<read_t, DataType>::value) {
+            reader.getSlice(sliceIdx, slice, 1, {1, 1}, {glm::vec3(0., 0., 0.), imgResolution});
+        } else {
+            std::vector<read_t> values;
+            reader.getSlice(sliceIdx, values, 1, {1, 1}, {glm::vec3(0., 0., 0.), imgResolution});
+            slice.assign(values.begin(), values.end());
+        }
+    };
 
-    if(smallFile)
-        for(int i = 0; i < fromGrid->sampler.image->tiffImageReader->imgResolution.z; ++i)
-            fromGrid->sampler.image->tiffImageReader->getImage<DataType>(i, cache[i], {glm::vec3(0., 0., 0.), fromGrid->sampler.image->tiffImageReader->imgResolution});
+    if(smallFile && !usePagedCache) {
+        // Slices are read ahead in a background thread while the previous ones are stored
+        ImageReader prefetchReader(*fromGrid->sampler.image);
+        SlicePrefetcher<DataType> prefetcher([&](int i, std::vector<DataType>& slice) {
+            readSlice(prefetchReader, i, slice);
+        }, 0, imgResolution.z, this->prefetchDepth);
+        std::vector<DataType> slice;
+        int i = 0;
+        while((i = prefetcher.getNextSlice(slice)) != -1)
+            cache[i].swap(slice);
+    }
 
-    #pragma omp parallel for schedule(static) if(smallFile)
+    #pragma omp parallel for schedule(static) if(smallFile || usePagedCache)
     for(int tetIdx = 0; tetIdx < fromGrid->mesh.size(); ++tetIdx) {
         //std::cout << "Tet: " << tetIdx << "/" << fromGrid->mesh.size() << std::endl;
         const Tetrahedron& tet = fromGrid->mesh[tetIdx];
@@ -1976,23 +2077,43 @@ void Scene::writeDeformedImageTemplated(const std::string& filename, const std::
                             //p *= fromGrid->sampler.resolutionRatio;
                             //p += glm::vec3(.5, .5, .5);
                             int imgIdxLoad = std::floor(p.z);
-                            int idxLoad = std::floor(p.x) + std::floor(p.y) * fromGrid->sampler.image->tiffImageReader->imgResolution.x;
+                            int idxLoad = std::floor(p.x) + std::floor(p.y) * imgResolution.x;
 
                             if(img[k][insertIdx] == 0) {
 
                                 bool isInBBox = true;
                                 for(int l = 0; l < 3; ++l) {
-                                    if(p[l] < 0. || p[l] >= fromGrid->sampler.image->tiffImageReader->imgResolution[l])
+                                    if(p[l] < 0. || p[l] >= imgResolution[l])
                                         isInBBox = false;
                                 }
-
-                                if(isInBBox) {
+                                // The background stays 0, and its slices are not loaded
+                                if(isInBBox && skipBackground && fromGrid->sampler.isBackground(p))
+                                    isInBBox = false;
+
+                                if(isInBBox && usePagedCache) {
+                                    // The grid is queried in the coordinates of the sampler, not of the full resolution image
+                                    glm::vec3 pSampler = p;
+                                    fromGrid->sampler.fromImageToSampler(pSampler);
+                                    const uint16_t value = fromGrid->getValueFromPoint(pSampler);
+                                    if(useCustomColor) {
+                                        if(k >= 0 && k < img_color.size() && insertIdx*3 < img_color[0].size() && insertIdx >= 0 && value < data.size() && data[value]) {
+                                            glm::vec3 color = data_color[value];
+                                            insertIdx *= 3;
+                                            img_color[k][insertIdx] = static_cast<uint8_t>(color.r * 255.);
+                                            img_color[k][insertIdx+1] = static_cast<uint8_t>(color.g * 255.);
+                                            img_color[k][insertIdx+2] = static_cast<uint8_t>(color.b * 255.);
+                                        }
+                                    } else {
+                                        if(k >= 0 && k < img.size() && insertIdx < img[0].size() && insertIdx >= 0)
+                                            img[k][insertIdx] = static_cast<DataType>(value);
+                                    }
+                                } else if(isInBBox) {
                                     bool imgAlreadyLoaded = cache.find(imgIdxLoad) != cache.end();
                                     if(!imgAlreadyLoaded) {
                                         if(cache.size() > cacheMaxNb) {
                                             cache.erase(cache.begin());
                                         }
-                                        fromGrid->sampler.image->tiffImageReader->getImage<DataType>(imgIdxLoad, cache[imgIdxLoad], {glm::vec3(0., 0., 0.), fromGrid->sampler.image->tiffImageReader->imgResolution});
+                                        readSlice(*fromGrid->sampler.image, imgIdxLoad, cache[imgIdxLoad]);
                                     }
                                     if(useCustomColor) {
                                         if(k >= 0 && k < img_color.size() && insertIdx*3 < img_color[0].size() && insertIdx >= 0) {
@@ -2117,6 +2238,16 @@ void Scene::writeGreyscaleTIFFImage(const std::string& filename, const glm::vec3
     std::cout << "Save sucessfull" << std::endl;
 }
 
+void Scene::writeBrickedImage(const std::string& filename, const std::string& gridName) {
+    int gridIdx = this->getGridIdx(gridName);
+    if(gridIdx == -1)
+        return;
+    if(::writeBrickedImage(*this->grids[gridIdx]->sampler.image, filename)) {
+        std::cout << "Destination: " << filename << std::endl;
+        std::cout << "Save sucessfull" << std::endl;
+    }
+}
+
 void Scene::clear() {
     this->updateTools(MeshManipulatorType::NONE);
     this->grids_name.clear();
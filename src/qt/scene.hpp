@@ -36,6 +36,7 @@
 #include <tinytiffwriter.h>
 
 #include "../core/geometry/grid.hpp"
+#include "../core/images/prefetcher.hpp"
 #include "../core/geometry/graph_mesh.hpp"
 #include "../core/drawable/drawable_surface_mesh.hpp"
 #include "../core/drawable/drawable_selection.hpp"
@@ -129,7 +130,9 @@ public:
     GLuint uploadTexture1D(const TextureUpload& tex);
     GLuint uploadTexture2D(const TextureUpload& tex);
     GLuint uploadTexture3D(const TextureUpload& tex);
-    GLuint newAPI_uploadTexture3D(const GLuint handle, const TextureUpload& tex, std::size_t s, std::vector<std::uint16_t>& data);
+    //! @brief Upload the slice s of a 3D texture, DataType must match tex.type (uint8_t or uint16_t).
+    template<typename DataType>
+    GLuint newAPI_uploadTexture3D(const GLuint handle, const TextureUpload& tex, std::size_t s, std::vector<DataType>& data);
     GLuint newAPI_uploadTexture3D_allocateonly(const TextureUpload& tex);
 
     void recompileShaders(bool verbose = true);
@@ -223,6 +226,10 @@ public:
     //! This function is currently unused but still usefull for further developement.
     void writeGreyscaleTIFFImage(const std::string& filename, const glm::vec3& imgDimensions, const std::vector<std::vector<uint16_t>>& data);
 
+    //! @brief Write the original image of a grid as a bricked image, see writeBrickedImage().
+    //! Opening this copy instead of the original image avoids to decode and convert it again at each session.
+    void writeBrickedImage(const std::string& filename, const std::string& gridName);
+
 
 signals:
     // Signals to the meshManipulator tools
@@ -340,6 +347,7 @@ public slots:
     // Rendering slots
     void setColorChannel(ColorChannel mode);
     void updateTetmeshAllGrids(bool updateAllInfos = false);
+    //! @brief Upload the values of a grid to its texture, and store its min/max values in its sampler, see Sampler::setMinMax().
     std::pair<uint16_t, uint16_t> sendGridValuesToGPU(int gridIdx);
     void setLightPosition(const glm::vec3& lighPosition);
 
@@ -352,8 +360,14 @@ public slots:
     bool openCage(const std::string& name, const std::string& filename, const std::string& surfaceMeshToDeformName, const bool MVC = true, const glm::vec4& color = glm::vec4(1., 0., 0., 0.1));
     bool linkCage(const std::string& cageName, BaseMesh * meshToDeform, const bool MVC);
 
-    bool openGrid(const std::string& name, const std::vector<std::string>& imgFilenames, const int subsample, const glm::vec3& sizeVoxel, const glm::vec3& nbCubeGridTransferMesh = glm::vec3(5., 5., 5.));
-    bool openGrid(const std::string& name, const std::vector<std::string>& imgFilenames, const int subsample, const glm::vec3& sizeVoxel, const std::string& transferMeshFileName);
+    //! @param roi Region of the image to load, in image voxels, the whole image by default.
+    //! @param memoryBudget Size in bytes above which the image is read on demand instead of being loaded, see Sampler::memoryBudget.
+    //! @param useIndexFile Cache the metadata of a TIFF image in a sidecar file, see ImageIndex .
+    bool openGrid(const std::string& name, const std::vector<std::string>& imgFilenames, const int subsample, const glm::vec3& sizeVoxel, const glm::vec3& nbCubeGridTransferMesh = glm::vec3(5., 5., 5.), SubsampleMethod subsampleMethod = SubsampleMethod::Mean, const std::pair<glm::vec3, glm::vec3>& roi = Sampler::getWholeImageROI(), std::size_t memoryBudget = 0, bool useIndexFile = false);
+    bool openGrid(const std::string& name, const std::vector<std::string>& imgFilenames, const int subsample, const glm::vec3& sizeVoxel, const std::string& transferMeshFileName, SubsampleMethod subsampleMethod = SubsampleMethod::Mean, const std::pair<glm::vec3, glm::vec3>& roi = Sampler::getWholeImageROI(), std::size_t memoryBudget = 0, bool useIndexFile = false);
+    //! @brief Grow the region of interest of a grid to include [roiMin, roiMax], in image voxels, and send it again to the GPU.
+    //! Only the voxels that were not loaded yet are read from the image. The deformations of the grid are lost.
+    bool expandGridROI(const std::string& name, const glm::vec3& roiMin, const glm::vec3& roiMax);
     void addGridToScene(const std::string& name, Grid * newGrid);
     int autofitSubsample(int initialSubsample, const std::vector<std::string>& imgFilenames);
     SurfaceMesh * getMesh(const std::string& name);
@@ -404,6 +418,7 @@ public:
     GL::Selection * glSelection;
 
     int maximumTextureSize;// Set by the viewer
+    int prefetchDepth;// Nb of slices read ahead during sequential passes over an image
     int activeGrid = -1;
     std::vector<int> gridsToDraw;
 